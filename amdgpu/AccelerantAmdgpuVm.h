@@ -0,0 +1,23 @@
+/*
+ * Optional accelerant interface for the AMDGPU_VM_OP_* requests of
+ * DRM_AMDGPU_VM, queried with QueryInterface(). libdrm_amdgpu returns
+ * ENOSYS for VMID reservations if the accelerant doesn't provide it.
+ */
+
+#pragma once
+
+#include <SupportDefs.h>
+
+#define B_ACCELERANT_IFACE_AMDGPU_VM "amdgpu_vm"
+
+union drm_amdgpu_vm;
+
+typedef struct accelerant_amdgpu_vm accelerant_amdgpu_vm;
+
+struct accelerant_amdgpu_vm_vt {
+	int (*AmdgpuVm)(accelerant_amdgpu_vm *acc, union drm_amdgpu_vm *args);
+};
+
+struct accelerant_amdgpu_vm {
+	struct accelerant_amdgpu_vm_vt *vt;
+};
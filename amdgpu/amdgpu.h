@@ -68,6 +68,31 @@ struct drm_amdgpu_bo_list_entry;
  */
 #define AMDGPU_QUERY_FENCE_TIMEOUT_IS_ABSOLUTE     (1 << 0)
 
+/**
+ * Used as ring index of amdgpu_cs_request, meaning that amdgpu_cs_submit()
+ * picks the available ring of the IP with the fewest submissions not yet
+ * known to have completed.
+ */
+#define AMDGPU_CS_RING_AUTO			0xffffffff
+
+/**
+ * Number of latency buckets of amdgpu_cs_ring_stats. Bucket 0 counts
+ * latencies below 1 us, bucket i those from 2^(i-1) us to below 2^i us and
+ * the last bucket all longer ones.
+ */
+#define AMDGPU_CS_STATS_BUCKETS			24
+
+/**
+ * Number of samples kept per sensor by the sensor sampler.
+ */
+#define AMDGPU_SENSOR_HISTORY_SIZE		64
+
+/**
+ * Resource access flags of amdgpu_bo_list_set_usage().
+ */
+#define AMDGPU_BO_USAGE_READ			(1 << 0)
+#define AMDGPU_BO_USAGE_WRITE			(1 << 1)
+
 /*--------------------------------------------------------------------------*/
 /* ----------------------------- Enums ------------------------------------ */
 /*--------------------------------------------------------------------------*/
@@ -139,6 +164,11 @@ typedef struct amdgpu_bo_list *amdgpu_bo_list_handle;
  */
 typedef struct amdgpu_va *amdgpu_va_handle;
 
+/**
+ * Define handle for an IB ring allocator
+ */
+typedef struct amdgpu_ib_ring *amdgpu_ib_ring_handle;
+
 /**
  * Define handle for semaphore
  */
@@ -310,6 +340,10 @@ struct amdgpu_cs_ib_info {
 /**
  * Structure describing fence information
  *
+ * \note The first location used for a ring is CPU mapped and referenced by
+ *	 the context until it is freed, amdgpu_cs_query_fence_status() reads
+ *	 completed sequence numbers from it directly.
+ *
  * \sa amdgpu_cs_request, amdgpu_cs_query_fence,
  *     amdgpu_cs_submit(), amdgpu_cs_query_fence_status()
 */
@@ -341,6 +375,9 @@ struct amdgpu_cs_request {
 	/**
 	 * Specify ring index of the IP. We could have several rings
 	 * in the same IP. E.g. 0 for SDMA0 and 1 for SDMA1.
+	 *
+	 * With AMDGPU_CS_RING_AUTO the ring is chosen on submission and
+	 * written back here, fences of the request must use that ring.
 	 */
 	uint32_t ring;
 
@@ -422,6 +459,71 @@ struct amdgpu_heap_info {
 	uint64_t max_allocation;
 };
 
+/**
+ * Sensor value recorded by the sensor sampler
+ *
+ * \sa amdgpu_sensor_read_latest(), amdgpu_sensor_read_history()
+ *
+ */
+struct amdgpu_sensor_sample {
+	/** CLOCK_MONOTONIC time of the sample in nanoseconds */
+	uint64_t time_ns;
+	/** Value as returned by amdgpu_query_sensor_info() */
+	uint32_t value;
+};
+
+/**
+ * Information about all heaps
+ *
+ * \sa amdgpu_query_heap_info_all()
+ *
+ */
+struct amdgpu_heap_info_all {
+	/** All VRAM */
+	struct amdgpu_heap_info vram;
+	/** CPU visible VRAM */
+	struct amdgpu_heap_info vram_cpu_accessible;
+	/** GTT */
+	struct amdgpu_heap_info gtt;
+};
+
+/**
+ * Command submission statistics of a ring, summed over all contexts of a
+ * device while collection is enabled.
+ *
+ * \sa amdgpu_cs_query_stats()
+ *
+ */
+struct amdgpu_cs_ring_stats {
+	/** Requests passed to amdgpu_cs_submit() */
+	uint64_t requests;
+
+	/**
+	 * Submissions passed to the kernel driver. Fewer than requests
+	 * when an asynchronous context merged requests.
+	 */
+	uint64_t submissions;
+
+	/** IBs and their total size in bytes of all submissions */
+	uint64_t ibs;
+	uint64_t ib_bytes;
+
+	/** Dependencies passed to the kernel driver */
+	uint64_t dependencies;
+
+	/** Fence waits passed to the kernel driver */
+	uint64_t waits;
+
+	/** Time spent in amdgpu_cs_submit() per request */
+	uint64_t request_latency[AMDGPU_CS_STATS_BUCKETS];
+
+	/** Time the kernel driver took to accept a submission */
+	uint64_t submit_latency[AMDGPU_CS_STATS_BUCKETS];
+
+	/** Time spent waiting for a fence in the kernel driver */
+	uint64_t wait_latency[AMDGPU_CS_STATS_BUCKETS];
+};
+
 /**
  * Describe GPU h/w info needed for UMD correct initialization
  *
@@ -490,6 +592,20 @@ struct amdgpu_gpu_info {
 	uint32_t pci_rev_id;
 };
 
+/**
+ * Range of consecutive registers read by amdgpu_read_mm_registers_batch()
+ */
+struct amdgpu_mm_register_range {
+	/** Register offset in dwords */
+	uint32_t dword_offset;
+	/** The number of registers to read */
+	uint32_t count;
+	/** GRBM_GFX_INDEX selector, 0xffffffff if unsure */
+	uint32_t instance;
+	/** Flags with additional information */
+	uint32_t flags;
+};
+
 
 /*--------------------------------------------------------------------------*/
 /*------------------------- Functions --------------------------------------*/
@@ -533,6 +649,27 @@ int amdgpu_device_initialize_haiku(struct accelerant_base *acc,
 			     uint32_t *minor_version,
 			     amdgpu_device_handle *device_handle);
 
+/**
+ * Initialize every AMD GPU returned by drmGetDevices2() concurrently.
+ *
+ * Devices failing to initialize are skipped. The file descriptors opened
+ * for the initialization are closed again, the handles keep their own
+ * reference to the accelerant.
+ *
+ * \param   max_devices    - \c [in]  Size of \c devices
+ * \param   devices        - \c [out] Initialized devices, each to be freed
+ *                                    with amdgpu_device_deinitialize()
+ * \param   num_devices    - \c [out] Number of initialized devices
+ *
+ * \return   0 on success, even if no device was found\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_device_initialize()
+*/
+int amdgpu_device_initialize_all(uint32_t max_devices,
+				 amdgpu_device_handle *devices,
+				 uint32_t *num_devices);
+
 /**
  *
  * When access to such library does not needed any more the special
@@ -878,6 +1015,27 @@ int amdgpu_bo_list_update(amdgpu_bo_list_handle handle,
 			  amdgpu_bo_handle *resources,
 			  uint8_t *resource_prios);
 
+/**
+ * Set how the submissions using a BO list access its resources.
+ *
+ * Only used by contexts with implicit synchronization enabled, see
+ * amdgpu_cs_ctx_set_implicit_sync(). Resources default to
+ * AMDGPU_BO_USAGE_READ | AMDGPU_BO_USAGE_WRITE, amdgpu_bo_list_update()
+ * resets them to that.
+ *
+ * \param   handle              - \c [in] BO list handle
+ * \param   number_of_resources - \c [in] Number of BOs in the list
+ * \param   usage               - \c [in] AMDGPU_BO_USAGE_* flags of each BO
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_list_create()
+*/
+int amdgpu_bo_list_set_usage(amdgpu_bo_list_handle handle,
+			     uint32_t number_of_resources,
+			     const uint32_t *usage);
+
 /*
  * GPU Execution context
  *
@@ -932,12 +1090,98 @@ int amdgpu_cs_ctx_create(amdgpu_device_handle dev,
 */
 int amdgpu_cs_ctx_free(amdgpu_context_handle context);
 
+/**
+ * Switch a context between synchronous and asynchronous submission.
+ *
+ * In asynchronous mode amdgpu_cs_submit() only validates the requests,
+ * assigns their sequence numbers and queues them; a worker thread owned by
+ * the context hands them to the kernel driver, merging consecutive
+ * compatible requests to the same ring into one submission. Sequence
+ * numbers of such a context are assigned by the library.
+ * amdgpu_cs_query_fence_status() and dependencies on them wait for the
+ * worker if the request is still queued. A failed submission signals its
+ * fence, the error is returned by the next amdgpu_cs_submit() call.
+ *
+ * \param   context - \c [in] GPU Context handle
+ * \param   enable  - \c [in] true for asynchronous submission
+ *
+ * \return  0 on success\n
+ *          EBUSY if the context already submitted work\n
+ *          otherwise POSIX Error code
+ *
+ * \sa amdgpu_cs_submit()
+ */
+int amdgpu_cs_ctx_set_async_submit(amdgpu_context_handle context, bool enable);
+
+/**
+ * Let an asynchronous context hold back submissions to merge them with
+ * compatible requests that follow shortly after.
+ *
+ * Requests are compatible if they go to the same ring with the same
+ * resources and fence setup and have no dependencies. A submission is
+ * held back at most \c window_us after its first request was queued and
+ * is passed on early once it reached \c max_ibs IBs, or when
+ * amdgpu_cs_query_fence_status() or a dependency asks for one of its
+ * fences.
+ *
+ * \param   context   - \c [in] GPU Context handle
+ * \param   window_us - \c [in] Coalescing window in microseconds, 0 to
+ *			       only merge requests that are already queued
+ * \param   max_ibs   - \c [in] IBs per merged submission, 0 or values
+ *			       above AMDGPU_CS_MAX_IBS_PER_SUBMIT select
+ *			       AMDGPU_CS_MAX_IBS_PER_SUBMIT
+ *
+ * \return  0 on success\n
+ *          EINVAL if the context does not use asynchronous submission\n
+ *          otherwise POSIX Error code
+ *
+ * \sa amdgpu_cs_ctx_set_async_submit()
+ */
+int amdgpu_cs_ctx_set_coalescing(amdgpu_context_handle context,
+				 uint32_t window_us, uint32_t max_ibs);
+
+/**
+ * Let the library order the submissions of a context after earlier
+ * conflicting accesses to the BOs of their resource list.
+ *
+ * A submission waits for the last write to each of its resources and, if
+ * it writes a resource, for all reads since, unless they were submitted
+ * to the same ring or are known to have completed. Accesses default to
+ * read and write, see amdgpu_bo_list_set_usage(). Only submissions of
+ * contexts with implicit sync enabled are tracked, and those of the
+ * whole device are serialized while that happens.
+ *
+ * Submissions made while it was enabled stay tracked after disabling it.
+ * Neither disabling it nor freeing the context waits for them, a freed
+ * context only keeps its kernel context until they completed.
+ *
+ * \param   context - \c [in] GPU Context handle
+ * \param   enable  - \c [in] true to synchronize implicitly
+ *
+ * \return  0 on success\n
+ *          otherwise POSIX Error code
+ *
+ * \sa amdgpu_bo_list_set_usage()
+ */
+int amdgpu_cs_ctx_set_implicit_sync(amdgpu_context_handle context,
+				    bool enable);
+
 /**
  * Override the submission priority for the given context using a master fd.
  *
+ * The priority decides the order in which the workers of asynchronous
+ * contexts of a device pass queued requests on: a worker holds back while
+ * contexts of higher priority have requests queued, for at most 2 ms per
+ * submission.
+ *
+ * The priority is only stored by the library and never reaches the
+ * driver, so the GPU scheduler still runs the context at the priority it
+ * was created with. Synchronous submissions are not affected at all.
+ *
  * \param   dev        - \c [in] device handle
  * \param   context    - \c [in] context handle for context id
- * \param   master_fd  - \c [in] The master fd to authorize the override.
+ * \param   master_fd  - \c [in] The master fd to authorize the override,
+ *				  unused on Haiku.
  * \param   priority   - \c [in] The priority to assign to the context.
  *
  * \return 0 on success or a a negative Posix error code on failure.
@@ -998,6 +1242,71 @@ int amdgpu_cs_query_reset_state2(amdgpu_context_handle context,
  *
 */
 
+/**
+ * Create an IB ring allocator for a context.
+ *
+ * IB space is carved linearly from one CPU and GPU mapped GTT buffer
+ * instead of a buffer per command stream. Allocations honour the
+ * ib_start_alignment and ib_size_alignment of the IP and are reclaimed in
+ * order once the fence passed to amdgpu_cs_ib_ring_fence() after them
+ * signaled.
+ *
+ * \param   context     - \c [in]  GPU Context
+ * \param   ip_type     - \c [in]  Hardware IP block type the IBs are for
+ * \param   ip_instance - \c [in]  Index of the IP block of the same type
+ * \param   size        - \c [in]  Size of the buffer in bytes
+ * \param   ib_ring     - \c [out] IB ring allocator
+ *
+ * \return  0 on success otherwise POSIX Error code
+ *
+ * \sa amdgpu_cs_ib_ring_alloc(), amdgpu_cs_ib_ring_fence()
+*/
+int amdgpu_cs_ib_ring_create(amdgpu_context_handle context, unsigned ip_type,
+			     unsigned ip_instance, uint64_t size,
+			     amdgpu_ib_ring_handle *ib_ring);
+
+/**
+ * Destroy an IB ring allocator after waiting for all fenced allocations.
+ *
+ * \param   ib_ring - \c [in] IB ring allocator
+ *
+ * \return  0 on success otherwise POSIX Error code
+*/
+int amdgpu_cs_ib_ring_destroy(amdgpu_ib_ring_handle ib_ring);
+
+/**
+ * Allocate space for an IB.
+ *
+ * Waits for the oldest fenced allocations if the buffer is full.
+ *
+ * \param   ib_ring - \c [in]  IB ring allocator
+ * \param   size_dw - \c [in]  Size of the IB in dwords
+ * \param   ib      - \c [out] ib_mc_address and size are set, size is
+ *			       rounded up to ib_size_alignment and the
+ *			       caller pads the IB up to it
+ * \param   cpu     - \c [out] CPU address of the IB
+ *
+ * \return  0 on success\n
+ *          ENOMEM if the buffer is full of allocations not yet fenced\n
+ *          otherwise POSIX Error code
+*/
+int amdgpu_cs_ib_ring_alloc(amdgpu_ib_ring_handle ib_ring, uint32_t size_dw,
+			    struct amdgpu_cs_ib_info *ib, void **cpu);
+
+/**
+ * Guard all allocations since the previous call with a fence.
+ *
+ * Called after submitting the IBs allocated so far, usually with the fence
+ * of that submission.
+ *
+ * \param   ib_ring - \c [in] IB ring allocator
+ * \param   fence   - \c [in] Fence that signals when the IBs are done
+ *
+ * \return  0 on success otherwise POSIX Error code
+*/
+int amdgpu_cs_ib_ring_fence(amdgpu_ib_ring_handle ib_ring,
+			    struct amdgpu_cs_fence *fence);
+
 /**
  * Send request to submit command buffers to hardware.
  *
@@ -1087,6 +1396,71 @@ int amdgpu_cs_wait_fences(struct amdgpu_cs_fence *fences,
 			  uint64_t timeout_ns,
 			  uint32_t *status, uint32_t *first);
 
+/**
+ * Wait for multiple fences until an absolute deadline.
+ *
+ * Like amdgpu_cs_wait_fences(), but the deadline is given as an absolute
+ * CLOCK_MONOTONIC time, so callers waiting in several steps compute it
+ * only once. Waiting for any fence polls the fences and then blocks on
+ * them one at a time, for slices growing from 50 us to 2 ms, so a fence
+ * signaling while another one is waited for is noticed late by at most
+ * the current slice.
+ *
+ * \param   fences      - \c [in] The fence array to wait
+ * \param   fence_count - \c [in] The fence count
+ * \param   wait_all    - \c [in] If true, wait all fences to be signaled,
+ *                                otherwise, wait at least one fence
+ * \param   deadline_ns - \c [in] Absolute deadline in nanoseconds, 0 to
+ *                                poll, AMDGPU_TIMEOUT_INFINITE for none
+ * \param   status      - \c [out] '1' for signaled, '0' for timeout
+ * \param   first       - \c [out] the index of the first signaled fence
+ *                                from @fences, only set if wait_all is false
+ *
+ * \return  0 on success
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_wait_fences(), amdgpu_cs_query_fence_status()
+*/
+int amdgpu_cs_wait_fences_deadline(struct amdgpu_cs_fence *fences,
+				   uint32_t fence_count,
+				   bool wait_all,
+				   uint64_t deadline_ns,
+				   uint32_t *status, uint32_t *first);
+
+/**
+ * Enable or disable collection of command submission statistics.
+ *
+ * Disabled collection costs one atomic read per submission and wait.
+ * Counters are kept when collection is disabled and continue when it is
+ * enabled again.
+ *
+ * \param   dev    - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   enable - \c [in] true to collect statistics
+ *
+ * \return  0 on success otherwise POSIX Error code
+ *
+ * \sa amdgpu_cs_query_stats()
+*/
+int amdgpu_cs_set_stats_enabled(amdgpu_device_handle dev, bool enable);
+
+/**
+ * Query command submission statistics of a ring
+ *
+ * \param   dev         - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   ip_type     - \c [in] Hardware IP block type = AMDGPU_HW_IP_*
+ * \param   ip_instance - \c [in] Index of the IP block of the same type
+ * \param   ring        - \c [in] Ring index of the IP
+ * \param   stats       - \c [out] Statistics, all zero if collection was
+ *				   never enabled
+ *
+ * \return  0 on success otherwise POSIX Error code
+ *
+ * \sa amdgpu_cs_set_stats_enabled()
+*/
+int amdgpu_cs_query_stats(amdgpu_device_handle dev, unsigned ip_type,
+			  unsigned ip_instance, uint32_t ring,
+			  struct amdgpu_cs_ring_stats *stats);
+
 /*
  * Query / Info API
  *
@@ -1177,6 +1551,26 @@ int amdgpu_query_hw_ip_info(amdgpu_device_handle dev, unsigned type,
 int amdgpu_query_heap_info(amdgpu_device_handle dev, uint32_t heap,
 			   uint32_t flags, struct amdgpu_heap_info *info);
 
+/**
+ * Query information about all heaps at once
+ *
+ * All heaps are filled from one query. Callers checking the heaps
+ * frequently can accept a snapshot taken by an earlier call for the same
+ * device, at most \c max_age_ns old.
+ *
+ * \param   dev        - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   max_age_ns - \c [in] Maximum age of a reused snapshot in
+ *                               nanoseconds, 0 to always query
+ * \param   info       - \c [out] Pointer to structure to get the information
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_query_heap_info()
+*/
+int amdgpu_query_heap_info_all(amdgpu_device_handle dev, uint64_t max_age_ns,
+			       struct amdgpu_heap_info_all *info);
+
 /**
  * Get the CRTC ID from the mode object ID
  *
@@ -1273,6 +1667,79 @@ int amdgpu_query_gds_info(amdgpu_device_handle dev,
 int amdgpu_query_sensor_info(amdgpu_device_handle dev, unsigned sensor_type,
 			     unsigned size, void *value);
 
+/**
+ * Start sampling sensors in the background.
+ *
+ * A thread of the device queries the given sensors every \c period_ns
+ * and keeps the last AMDGPU_SENSOR_HISTORY_SIZE values of each. Any
+ * number of threads can read them without querying the device.
+ * Sensors whose query fails are skipped for that period.
+ *
+ * \param   dev          - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   num_sensors  - \c [in] Number of sensors to sample
+ * \param   sensor_types - \c [in] AMDGPU_INFO_SENSOR_* of each sensor
+ * \param   period_ns    - \c [in] Sampling period in nanoseconds
+ *
+ * \return   0 on success\n
+ *          EBUSY if the sampler is already running\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_sensor_sampler_stop(), amdgpu_sensor_read_latest()
+*/
+int amdgpu_sensor_sampler_start(amdgpu_device_handle dev,
+				uint32_t num_sensors,
+				const uint32_t *sensor_types,
+				uint64_t period_ns);
+
+/**
+ * Stop sampling sensors. The samples taken so far stay readable.
+ *
+ * \param   dev - \c [in] Device handle. See #amdgpu_device_initialize()
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_sensor_sampler_start()
+*/
+int amdgpu_sensor_sampler_stop(amdgpu_device_handle dev);
+
+/**
+ * Read the last sample of a sensor.
+ *
+ * \param   dev         - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   sensor_type - \c [in] AMDGPU_INFO_SENSOR_*
+ * \param   sample      - \c [out] The last sample
+ *
+ * \return   0 on success\n
+ *          ENOENT if the sensor was not sampled yet\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_sensor_sampler_start(), amdgpu_sensor_read_history()
+*/
+int amdgpu_sensor_read_latest(amdgpu_device_handle dev, uint32_t sensor_type,
+			      struct amdgpu_sensor_sample *sample);
+
+/**
+ * Read the last samples of a sensor, oldest first.
+ *
+ * \param   dev         - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   sensor_type - \c [in] AMDGPU_INFO_SENSOR_*
+ * \param   max_samples - \c [in] Size of the samples array
+ * \param   samples     - \c [out] The samples
+ * \param   num_samples - \c [out] Number of samples returned, at most
+ *                                 AMDGPU_SENSOR_HISTORY_SIZE
+ *
+ * \return   0 on success\n
+ *          ENOENT if the sensor was not sampled yet\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_sensor_sampler_start(), amdgpu_sensor_read_latest()
+*/
+int amdgpu_sensor_read_history(amdgpu_device_handle dev, uint32_t sensor_type,
+			       uint32_t max_samples,
+			       struct amdgpu_sensor_sample *samples,
+			       uint32_t *num_samples);
+
 /**
  * Query information about video capabilities
  *
@@ -1311,6 +1778,28 @@ int amdgpu_read_mm_registers(amdgpu_device_handle dev, unsigned dword_offset,
 			     unsigned count, uint32_t instance, uint32_t flags,
 			     uint32_t *values);
 
+/**
+ * Read several ranges of memory-mapped registers.
+ *
+ * Ranges following each other in the list that continue the previous
+ * range with the same instance and flags are read with one query.
+ *
+ * \param   dev              - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   number_of_ranges - \c [in] Number of register ranges
+ * \param   ranges           - \c [in] The register ranges to read
+ * \param   values           - \c [out] The values of all ranges, one
+ *                                     after the other
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX error code
+ *
+ * \sa amdgpu_read_mm_registers()
+*/
+int amdgpu_read_mm_registers_batch(amdgpu_device_handle dev,
+				   uint32_t number_of_ranges,
+				   const struct amdgpu_mm_register_range *ranges,
+				   uint32_t *values);
+
 /**
  * Flag to request VA address range in the 32bit address space
 */
@@ -1510,6 +1999,11 @@ int amdgpu_cs_destroy_semaphore(amdgpu_semaphore_handle sem);
 /**
  *  Get the ASIC marketing name
  *
+ * The name is looked up in the text file named by LIBDRM_AMDGPU_IDS, then
+ * in the copy of amdgpu.ids built into the library. The installed
+ * amdgpu.ids is only read for devices missing from that copy, so renaming
+ * a device the library knows takes LIBDRM_AMDGPU_IDS.
+ *
  * \param   dev         - \c [in] Device handle. See #amdgpu_device_initialize()
  *
  * \return  the constant string of the marketing name
@@ -1860,26 +2354,52 @@ int amdgpu_cs_submit_raw2(amdgpu_device_handle dev,
 			  struct drm_amdgpu_cs_chunk *chunks,
 			  uint64_t *seq_no);
 
-void amdgpu_cs_chunk_fence_to_dep(struct amdgpu_cs_fence *fence,
-				  struct drm_amdgpu_cs_chunk_dep *dep);
+/**
+ * Convert a fence to a dependency chunk for amdgpu_cs_submit_raw2().
+ *
+ * Fences of asynchronous contexts are translated to the kernel sequence
+ * number, waiting up to a second for the context to submit them.
+ *
+ * \param   fence - \c [in]  Fence to depend on
+ * \param   dep   - \c [out] Dependency, only written on success
+ *
+ * \return   0 on success\n
+ *          ETIME if the fence was not submitted in time\n
+ *          <0 - Negative POSIX Error code
+ */
+int amdgpu_cs_chunk_fence_to_dep(struct amdgpu_cs_fence *fence,
+				 struct drm_amdgpu_cs_chunk_dep *dep);
 void amdgpu_cs_chunk_fence_info_to_data(struct amdgpu_cs_fence_info *fence_info,
 					struct drm_amdgpu_cs_chunk_data *data);
 
 /**
  * Reserve VMID
- * \param   context - \c [in]  GPU Context
- * \param   flags - \c [in]  TBD
  *
- * \return  0 on success otherwise POSIX Error code
+ * Reserving a dedicated VMID for the VM of the device avoids the VM
+ * flushes caused by switching VMIDs. Reservations are reference counted,
+ * the VMID stays reserved until every reservation was released with
+ * amdgpu_vm_unreserve_vmid().
+ *
+ * The request is passed on through the optional B_ACCELERANT_IFACE_AMDGPU_VM
+ * interface of the accelerant.
+ *
+ * \param   dev - \c [in]  Device handle
+ * \param   flags - \c [in]  Must be 0
+ *
+ * \return  0 on success\n
+ *          ENOSYS if the accelerant can't reserve VMIDs\n
+ *          otherwise POSIX Error code
 */
 int amdgpu_vm_reserve_vmid(amdgpu_device_handle dev, uint32_t flags);
 
 /**
  * Free reserved VMID
- * \param   context - \c [in]  GPU Context
- * \param   flags - \c [in]  TBD
+ * \param   dev - \c [in]  Device handle
+ * \param   flags - \c [in]  Must be 0
  *
- * \return  0 on success otherwise POSIX Error code
+ * \return  0 on success\n
+ *          EINVAL if the VMID is not reserved\n
+ *          otherwise POSIX Error code
 */
 int amdgpu_vm_unreserve_vmid(amdgpu_device_handle dev, uint32_t flags);
 
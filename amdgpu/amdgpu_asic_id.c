@@ -29,6 +29,9 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "xf86drm.h"
 #include "amdgpu_drm.h"
@@ -104,20 +107,150 @@ out:
 	return r;
 }
 
-void amdgpu_parse_asic_ids(struct amdgpu_device *dev)
+/* Binary index of amdgpu.ids, see gen_asic_id_index.py */
+#define AMDGPU_ASIC_ID_INDEX_MAGIC	0x58444941
+#define AMDGPU_ASIC_ID_INDEX_VERSION	1
+#define AMDGPU_ASIC_ID_INDEX_EMPTY	0xffffffff
+
+struct amdgpu_asic_id_index_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_buckets;
+	uint32_t num_slots;
+	/* followed by uint32_t displacement[num_buckets], the slots and the
+	 * names */
+};
+
+struct amdgpu_asic_id_index_slot {
+	uint32_t key;
+	uint32_t name;
+};
+
+static uint32_t amdgpu_asic_id_hash(uint32_t key, uint32_t seed)
+{
+	uint32_t h = key ^ seed;
+
+	h ^= h >> 16;
+	h *= 0x7feb352d;
+	h ^= h >> 15;
+	h *= 0x846ca68b;
+	h ^= h >> 16;
+	return h;
+}
+
+/**
+ * Look the device up in the binary index.
+ *
+ * \return  0 if the lookup was done, even if the device is not listed,
+ *	    otherwise POSIX error code and the text file has to be parsed
+ */
+static int amdgpu_find_asic_id(struct amdgpu_device *dev, const void *index,
+			       size_t size)
+{
+	const struct amdgpu_asic_id_index_header *header = index;
+	const struct amdgpu_asic_id_index_slot *slots, *slot;
+	const uint32_t *displacement;
+	const char *names, *name;
+	size_t names_offset, names_size;
+	uint32_t key;
+
+	if (size < sizeof(*header) ||
+	    header->magic != AMDGPU_ASIC_ID_INDEX_MAGIC ||
+	    header->version != AMDGPU_ASIC_ID_INDEX_VERSION ||
+	    !header->num_buckets || !header->num_slots)
+		return EINVAL;
+
+	names_offset = sizeof(*header) +
+		       (size_t)header->num_buckets * sizeof(uint32_t) +
+		       (size_t)header->num_slots * sizeof(*slots);
+	if (names_offset > size)
+		return EINVAL;
+
+	displacement = (const uint32_t *)(header + 1);
+	slots = (const struct amdgpu_asic_id_index_slot *)
+		(displacement + header->num_buckets);
+	names = (const char *)index + names_offset;
+	names_size = size - names_offset;
+
+	key = dev->info.asic_id << 16 | dev->info.pci_rev_id;
+	slot = &slots[amdgpu_asic_id_hash(key,
+			displacement[amdgpu_asic_id_hash(key, 0) %
+				     header->num_buckets]) %
+		      header->num_slots];
+	if (slot->key != key)
+		return 0;
+
+	if (slot->name >= names_size)
+		return EINVAL;
+	name = names + slot->name;
+	if (!memchr(name, '\0', names_size - slot->name))
+		return EINVAL;
+
+	dev->marketing_name = strdup(name);
+	return dev->marketing_name ? 0 : ENOMEM;
+}
+
+/**
+ * Look the device up in AMDGPU_ASIC_ID_INDEX unless amdgpu.ids changed
+ * after the index was generated.
+ *
+ * \return  0 if the lookup was done, otherwise the text file has to be
+ *	    parsed
+ */
+static int amdgpu_parse_asic_id_index(struct amdgpu_device *dev)
+{
+	struct stat index_st, table_st;
+	void *index;
+	int fd, r;
+
+	fd = open(AMDGPU_ASIC_ID_INDEX, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return errno;
+
+	if (fstat(fd, &index_st)) {
+		r = errno;
+		close(fd);
+		return r;
+	}
+
+	if (!stat(AMDGPU_ASIC_ID_TABLE, &table_st) &&
+	    table_st.st_mtime > index_st.st_mtime) {
+		close(fd);
+		return ESTALE;
+	}
+
+	index = mmap(NULL, index_st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (index == MAP_FAILED)
+		return errno;
+
+	r = amdgpu_find_asic_id(dev, index, index_st.st_size);
+	munmap(index, index_st.st_size);
+	return r;
+}
+
+/**
+ * Look the device up in an amdgpu.ids text file. A missing file is only
+ * reported if it was \c requested explicitly.
+ *
+ * \return  0 if the device was found, otherwise POSIX error code
+ */
+static int amdgpu_parse_asic_id_table(struct amdgpu_device *dev,
+				      const char *path, bool requested)
 {
 	FILE *fp;
 	char *line = NULL;
 	size_t len = 0;
 	ssize_t n;
 	int line_num = 1;
-	int r = 0;
+	int r = ENOENT;
 
-	fp = fopen(AMDGPU_ASIC_ID_TABLE, "r");
+	fp = fopen(path, "r");
 	if (!fp) {
-		fprintf(stderr, "%s: %s\n", AMDGPU_ASIC_ID_TABLE,
-			strerror(errno));
-		return;
+		r = errno;
+		if (requested)
+			fprintf(stderr, "%s: %s\n", path, strerror(r));
+		return r;
 	}
 
 	/* 1st valid line is file version */
@@ -132,7 +265,6 @@ void amdgpu_parse_asic_ids(struct amdgpu_device *dev)
 			continue;
 		}
 
-		fprintf(stderr, "%s version: %s\n", AMDGPU_ASIC_ID_TABLE, line);
 		break;
 	}
 
@@ -150,12 +282,74 @@ void amdgpu_parse_asic_ids(struct amdgpu_device *dev)
 
 	if (r == EINVAL) {
 		fprintf(stderr, "Invalid format: %s: line %d: %s\n",
-			AMDGPU_ASIC_ID_TABLE, line_num, line);
+			path, line_num, line);
 	} else if (r && r != EAGAIN) {
 		fprintf(stderr, "%s: Cannot parse ASIC IDs: %s\n",
-			__func__, strerror(-r));
+			__func__, strerror(r));
 	}
 
 	free(line);
 	fclose(fp);
+	return r == EAGAIN ? ENOENT : r;
+}
+
+struct amdgpu_asic_id {
+	uint32_t key;
+	const char *name;
+};
+
+/* amdgpu.ids at build time, sorted by key */
+#include "amdgpu_asic_id_table.h"
+
+static int amdgpu_asic_id_compare(const void *key, const void *entry)
+{
+	uint32_t a = *(const uint32_t *)key;
+	uint32_t b = ((const struct amdgpu_asic_id *)entry)->key;
+
+	return a < b ? -1 : a > b;
+}
+
+/**
+ * Look the device up in the table compiled into the library.
+ *
+ * \return  0 if the device was found, otherwise POSIX error code
+ */
+static int amdgpu_find_builtin_asic_id(struct amdgpu_device *dev)
+{
+	const struct amdgpu_asic_id *entry;
+	uint32_t key = dev->info.asic_id << 16 | dev->info.pci_rev_id;
+
+	entry = bsearch(&key, amdgpu_asic_id_table,
+			sizeof(amdgpu_asic_id_table) / sizeof(*entry),
+			sizeof(*entry), amdgpu_asic_id_compare);
+	if (!entry)
+		return ENOENT;
+
+	dev->marketing_name = strdup(entry->name);
+	return dev->marketing_name ? 0 : ENOMEM;
+}
+
+/**
+ * Resolve the marketing name of the device.
+ *
+ * A text file named by LIBDRM_AMDGPU_IDS overrides everything. Otherwise
+ * the built-in table answers without touching the filesystem, and only
+ * devices newer than the library are looked up in the installed index or
+ * amdgpu.ids.
+ */
+void amdgpu_parse_asic_ids(struct amdgpu_device *dev)
+{
+	const char *path = getenv("LIBDRM_AMDGPU_IDS");
+
+	if (path && path[0] && !amdgpu_parse_asic_id_table(dev, path, true))
+		return;
+
+	if (!amdgpu_find_builtin_asic_id(dev))
+		return;
+
+	/* the index is skipped if amdgpu.ids is newer */
+	if (!amdgpu_parse_asic_id_index(dev))
+		return;
+
+	amdgpu_parse_asic_id_table(dev, AMDGPU_ASIC_ID_TABLE, false);
 }
@@ -271,6 +271,7 @@ drm_public int amdgpu_bo_free(amdgpu_bo_handle buf_handle)
 
 		dev->acc_drm->vt->DrmCloseBufferHandle(dev->acc_drm, bo->handle);
 		pthread_mutex_destroy(&bo->cpu_access_mutex);
+		free(bo->sync.reads);
 		free(bo);
 	}
 
@@ -441,18 +442,85 @@ drm_public int amdgpu_bo_list_destroy_raw(amdgpu_device_handle dev,
 	return ENOSYS;
 }
 
+/**
+ * Copy the resources of a BO list. The accelerant keeps all BOs of the
+ * VM resident, so the list only lives in the library and is used for
+ * implicit synchronization. The list holds a reference to each BO.
+ */
+static int amdgpu_bo_list_set(struct amdgpu_bo_list *list,
+			      uint32_t number_of_resources,
+			      amdgpu_bo_handle *resources)
+{
+	amdgpu_bo_handle *new_resources;
+	uint32_t *usage;
+	uint32_t i;
+
+	new_resources = malloc(sizeof(*new_resources) * number_of_resources);
+	usage = malloc(sizeof(*usage) * number_of_resources);
+	if (!new_resources || !usage) {
+		free(new_resources);
+		free(usage);
+		return ENOMEM;
+	}
+
+	memcpy(new_resources, resources,
+	       sizeof(*new_resources) * number_of_resources);
+	for (i = 0; i < number_of_resources; i++) {
+		amdgpu_bo_inc_ref(new_resources[i]);
+		usage[i] = AMDGPU_BO_USAGE_READ | AMDGPU_BO_USAGE_WRITE;
+	}
+
+	/* after taking the new references, BOs in both lists survive */
+	for (i = 0; i < list->number_of_resources; i++)
+		amdgpu_bo_free(list->resources[i]);
+	free(list->resources);
+	free(list->usage);
+	list->resources = new_resources;
+	list->usage = usage;
+	list->number_of_resources = number_of_resources;
+	return 0;
+}
+
 drm_public int amdgpu_bo_list_create(amdgpu_device_handle dev,
 				     uint32_t number_of_resources,
 				     amdgpu_bo_handle *resources,
 				     uint8_t *resource_prios,
 				     amdgpu_bo_list_handle *result)
 {
-	return ENOSYS;
+	struct amdgpu_bo_list *list;
+	int r;
+
+	if (!dev || !result || !number_of_resources || !resources)
+		return EINVAL;
+
+	list = calloc(1, sizeof(struct amdgpu_bo_list));
+	if (!list)
+		return ENOMEM;
+
+	r = amdgpu_bo_list_set(list, number_of_resources, resources);
+	if (r) {
+		free(list);
+		return r;
+	}
+
+	list->dev = dev;
+	*result = list;
+	return 0;
 }
 
 drm_public int amdgpu_bo_list_destroy(amdgpu_bo_list_handle list)
 {
-	return ENOSYS;
+	uint32_t i;
+
+	if (!list)
+		return EINVAL;
+
+	for (i = 0; i < list->number_of_resources; i++)
+		amdgpu_bo_free(list->resources[i]);
+	free(list->resources);
+	free(list->usage);
+	free(list);
+	return 0;
 }
 
 drm_public int amdgpu_bo_list_update(amdgpu_bo_list_handle handle,
@@ -460,7 +528,22 @@ drm_public int amdgpu_bo_list_update(amdgpu_bo_list_handle handle,
 				     amdgpu_bo_handle *resources,
 				     uint8_t *resource_prios)
 {
-	return ENOSYS;
+	if (!handle || !number_of_resources || !resources)
+		return EINVAL;
+
+	return amdgpu_bo_list_set(handle, number_of_resources, resources);
+}
+
+drm_public int amdgpu_bo_list_set_usage(amdgpu_bo_list_handle handle,
+					uint32_t number_of_resources,
+					const uint32_t *usage)
+{
+	if (!handle || !usage ||
+	    number_of_resources != handle->number_of_resources)
+		return EINVAL;
+
+	memcpy(handle->usage, usage, sizeof(*usage) * number_of_resources);
+	return 0;
 }
 
 drm_public int amdgpu_bo_va_op(amdgpu_bo_handle bo,
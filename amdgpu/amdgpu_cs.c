@@ -26,7 +26,6 @@
 #include <string.h>
 #include <errno.h>
 #include <pthread.h>
-#include <sched.h>
 #include <sys/ioctl.h>
 #if HAVE_ALLOCA_H
 # include <alloca.h>
@@ -35,9 +34,89 @@
 #include "xf86drm.h"
 #include "amdgpu_drm.h"
 #include "amdgpu_internal.h"
+#include "util_math.h"
 
 static int amdgpu_cs_unreference_sem(amdgpu_semaphore_handle sem);
 static int amdgpu_cs_reset_sem(amdgpu_semaphore_handle sem);
+static void amdgpu_cs_release_user_fence(struct amdgpu_cs_user_fence *uf);
+
+/* Free semaphores kept for reuse, linked through their list member. */
+#define AMDGPU_CS_SEM_POOL_MAX 64
+static pthread_mutex_t sem_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct list_head sem_pool = { &sem_pool, &sem_pool };
+static unsigned sem_pool_count;
+
+/* Freed contexts kept for reuse, their sequence_mutex stays initialized.
+ * Pooled contexts are poisoned and the oldest one is reused first, so a
+ * stale handle is caught rather than aliasing a new context. */
+#define AMDGPU_CS_CTX_POOL_MAX 32
+#define AMDGPU_CS_CTX_POISON 0xdeadc0de
+static pthread_mutex_t ctx_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct list_head ctx_pool = { &ctx_pool, &ctx_pool };
+static unsigned ctx_pool_count;
+
+/**
+ * Free the rings of a context and put it into the pool of free contexts.
+ */
+drm_private void amdgpu_cs_ctx_release(amdgpu_context_handle context)
+{
+	struct amdgpu_cs_ring *ring, *next;
+
+	for (ring = context->ring_list; ring; ring = next) {
+		next = ring->next;
+		free(ring->sem_deps.fences);
+		amdgpu_cs_release_user_fence(&ring->user_fence);
+		free(ring);
+	}
+	memset(context->rings, 0, sizeof(context->rings));
+	context->ring_list = NULL;
+	context->dev = NULL;
+	context->id = AMDGPU_CS_CTX_POISON;
+	context->queue = NULL;
+	context->implicit_sync_serial = 0;
+	context->implicit_sync = false;
+
+	pthread_mutex_lock(&ctx_pool_mutex);
+	if (ctx_pool_count < AMDGPU_CS_CTX_POOL_MAX ||
+	    context->implicit_sync_pinned) {
+		list_add(&context->list, &ctx_pool);
+		ctx_pool_count++;
+		context = NULL;
+	}
+	pthread_mutex_unlock(&ctx_pool_mutex);
+
+	if (context) {
+		pthread_mutex_destroy(&context->sequence_mutex);
+		free(context);
+	}
+}
+
+/**
+ * Free the pooled contexts and semaphores, called when the last device
+ * goes away.
+ */
+drm_private void amdgpu_cs_pools_fini(void)
+{
+	struct amdgpu_context *context, *next_context;
+	struct amdgpu_semaphore *sem, *next_sem;
+
+	pthread_mutex_lock(&ctx_pool_mutex);
+	LIST_FOR_EACH_ENTRY_SAFE(context, next_context, &ctx_pool, list) {
+		list_del(&context->list);
+		pthread_mutex_destroy(&context->sequence_mutex);
+		free(context);
+	}
+	ctx_pool_count = 0;
+	pthread_mutex_unlock(&ctx_pool_mutex);
+
+	pthread_mutex_lock(&sem_pool_mutex);
+	LIST_FOR_EACH_ENTRY_SAFE(sem, next_sem, &sem_pool, list) {
+		list_del(&sem->list);
+		free(sem);
+	}
+	sem_pool_count = 0;
+	pthread_mutex_unlock(&sem_pool_mutex);
+}
 
 /**
  * Create command submission context
@@ -54,21 +133,35 @@ drm_public int amdgpu_cs_ctx_create2(amdgpu_device_handle dev,
 {
 	struct amdgpu_context *gpu_context;
 	union drm_amdgpu_ctx args;
-	int i, j, k;
 	int r;
 
 	if (!dev || !context)
 		return EINVAL;
 
-	gpu_context = calloc(1, sizeof(struct amdgpu_context));
-	if (!gpu_context)
-		return ENOMEM;
+	pthread_mutex_lock(&ctx_pool_mutex);
+	if (ctx_pool_count) {
+		gpu_context = LIST_LAST_ENTRY(&ctx_pool, struct amdgpu_context, list);
+		list_del(&gpu_context->list);
+		ctx_pool_count--;
+	} else {
+		gpu_context = NULL;
+	}
+	pthread_mutex_unlock(&ctx_pool_mutex);
 
-	gpu_context->dev = dev;
+	if (!gpu_context) {
+		gpu_context = calloc(1, sizeof(struct amdgpu_context));
+		if (!gpu_context)
+			return ENOMEM;
 
-	r = pthread_mutex_init(&gpu_context->sequence_mutex, NULL);
-	if (r)
-		goto error;
+		r = pthread_mutex_init(&gpu_context->sequence_mutex, NULL);
+		if (r) {
+			free(gpu_context);
+			return r;
+		}
+	}
+
+	gpu_context->dev = dev;
+	atomic_set(&gpu_context->priority, (int32)priority);
 
 	/* Create the context */
 	memset(&args, 0, sizeof(args));
@@ -80,17 +173,12 @@ drm_public int amdgpu_cs_ctx_create2(amdgpu_device_handle dev,
 		goto error;
 
 	gpu_context->id = args.out.alloc.ctx_id;
-	for (i = 0; i < AMDGPU_HW_IP_NUM; i++)
-		for (j = 0; j < AMDGPU_HW_IP_INSTANCE_MAX_COUNT; j++)
-			for (k = 0; k < AMDGPU_CS_MAX_RINGS; k++)
-				list_inithead(&gpu_context->sem_list[i][j][k]);
 	*context = (amdgpu_context_handle)gpu_context;
 
 	return 0;
 
 error:
-	pthread_mutex_destroy(&gpu_context->sequence_mutex);
-	free(gpu_context);
+	amdgpu_cs_ctx_release(gpu_context);
 	return r;
 }
 
@@ -109,34 +197,114 @@ drm_public int amdgpu_cs_ctx_create(amdgpu_device_handle dev,
  * \return  0 on success otherwise POSIX Error code
 */
 drm_public int amdgpu_cs_ctx_free(amdgpu_context_handle context)
+{
+	if (!context || !context->dev)
+		return EINVAL;
+
+	/* later submissions may still depend on the running ones. The queue
+	 * of an asynchronous context stays until then, the recorded fences
+	 * carry its sequence numbers. */
+	if (context->implicit_sync_serial &&
+	    amdgpu_cs_implicit_sync_retire(context))
+		return 0;
+
+	return amdgpu_cs_ctx_destroy(context);
+}
+
+/**
+ * Free the kernel context and release the context.
+ */
+drm_private int amdgpu_cs_ctx_destroy(amdgpu_context_handle context)
 {
 	union drm_amdgpu_ctx args;
-	int i, j, k;
 	int r;
 
-	if (!context)
-		return EINVAL;
-
-	pthread_mutex_destroy(&context->sequence_mutex);
+	/* flush queued submissions before the kernel context goes away */
+	if (context->queue)
+		amdgpu_cs_queue_destroy(context);
 
-	/* now deal with kernel side */
 	memset(&args, 0, sizeof(args));
 	args.in.op = AMDGPU_CTX_OP_FREE_CTX;
 	args.in.ctx_id = context->id;
 	r = context->dev->acc_amdgpu->vt->AmdgpuCtxRaw(context->dev->acc_amdgpu, &args);
-	for (i = 0; i < AMDGPU_HW_IP_NUM; i++) {
-		for (j = 0; j < AMDGPU_HW_IP_INSTANCE_MAX_COUNT; j++) {
-			for (k = 0; k < AMDGPU_CS_MAX_RINGS; k++) {
-				amdgpu_semaphore_handle sem;
-				LIST_FOR_EACH_ENTRY(sem, &context->sem_list[i][j][k], list) {
-					list_del(&sem->list);
-					amdgpu_cs_reset_sem(sem);
-					amdgpu_cs_unreference_sem(sem);
-				}
-			}
+	amdgpu_cs_ctx_release(context);
+
+	return r;
+}
+
+/**
+ * Look up the state of a ring and allocate it on first use.
+ *
+ * Must be called with sequence_mutex held.
+ *
+ * \return  The ring state, NULL if out of memory
+ */
+drm_private struct amdgpu_cs_ring *
+amdgpu_cs_create_ring(amdgpu_context_handle context, unsigned ip_type,
+		      unsigned ip_instance, uint32_t ring)
+{
+	struct amdgpu_cs_ring *cs_ring = context->rings[ip_type][ip_instance][ring];
+
+	if (cs_ring)
+		return cs_ring;
+
+	cs_ring = calloc(1, sizeof(struct amdgpu_cs_ring));
+	if (!cs_ring)
+		return NULL;
+
+	cs_ring->next = context->ring_list;
+	/* lock-free readers must see the ring initialized */
+	memory_write_barrier();
+	context->ring_list = cs_ring;
+	context->rings[ip_type][ip_instance][ring] = cs_ring;
+
+	return cs_ring;
+}
+
+drm_public int amdgpu_cs_ctx_set_async_submit(amdgpu_context_handle context,
+					      bool enable)
+{
+	struct amdgpu_cs_ring *ring;
+	int r = 0;
+
+	if (!context)
+		return EINVAL;
+
+	pthread_mutex_lock(&context->sequence_mutex);
+
+	/* sequence numbers of both modes must not mix */
+	for (ring = context->ring_list; ring; ring = ring->next) {
+		if (ring->last_seq) {
+			r = EBUSY;
+			goto out;
 		}
 	}
-	free(context);
+
+	if (enable && !context->queue)
+		r = amdgpu_cs_queue_create(context);
+	else if (!enable && context->queue)
+		amdgpu_cs_queue_destroy(context);
+
+out:
+	pthread_mutex_unlock(&context->sequence_mutex);
+	return r;
+}
+
+drm_public int amdgpu_cs_ctx_set_coalescing(amdgpu_context_handle context,
+					    uint32_t window_us,
+					    uint32_t max_ibs)
+{
+	int r = 0;
+
+	if (!context)
+		return EINVAL;
+
+	pthread_mutex_lock(&context->sequence_mutex);
+	if (context->queue)
+		amdgpu_cs_queue_set_coalescing(context, window_us, max_ibs);
+	else
+		r = EINVAL;
+	pthread_mutex_unlock(&context->sequence_mutex);
 
 	return r;
 }
@@ -146,7 +314,16 @@ drm_public int amdgpu_cs_ctx_override_priority(amdgpu_device_handle dev,
                                                int master_fd,
                                                unsigned priority)
 {
-	return ENOSYS;
+	if (!dev || !context || context->dev != dev)
+		return EINVAL;
+	if ((int)priority < AMDGPU_CTX_PRIORITY_VERY_LOW ||
+	    (int)priority > AMDGPU_CTX_PRIORITY_VERY_HIGH)
+		return EINVAL;
+
+	/* the accelerant has no scheduler override, only the library queues
+	 * of asynchronous contexts see the new priority */
+	atomic_set(&context->priority, (int32)priority);
+	return 0;
 }
 
 drm_public int amdgpu_cs_ctx_stable_pstate(amdgpu_context_handle context,
@@ -209,71 +386,231 @@ drm_public int amdgpu_cs_query_reset_state2(amdgpu_context_handle context,
 }
 
 /**
- * Submit command to kernel DRM
- * \param   dev - \c [in]  Device handle
+ * Remember the user fence location of a submission, so that later fence
+ * queries for the ring can read the sequence number straight from memory.
+ *
+ * Must be called after a successful submission, with sequence_mutex held
+ * or from the worker of an asynchronous context.
+ */
+drm_private void amdgpu_cs_record_user_fence(amdgpu_context_handle context,
+					     unsigned ip_type,
+					     unsigned ip_instance,
+					     uint32_t ring,
+					     struct amdgpu_cs_fence_info *info,
+					     uint64_t seq_no)
+{
+	struct amdgpu_cs_user_fence *uf;
+	struct amdgpu_cs_ring *other;
+	void *cpu;
+
+	uf = &context->rings[ip_type][ip_instance][ring]->user_fence;
+
+	if (uf->bo) {
+		/* the ring moved to another location, the old one goes stale */
+		if (uf->bo != info->handle || uf->offset != info->offset)
+			atomic_set(&uf->valid, 0);
+		else
+			atomic_set64((int64 *)&uf->last_seq, seq_no);
+		return;
+	}
+
+	amdgpu_bo_inc_ref(info->handle);
+	uf->bo = info->handle;
+	uf->offset = info->offset;
+	if (amdgpu_bo_cpu_map(info->handle, &cpu))
+		return;
+
+	uf->cpu = (volatile uint64_t *)cpu + info->offset;
+	uf->first_seq = seq_no;
+	uf->last_seq = seq_no;
+
+	/* a location shared by several rings holds foreign sequence numbers */
+	for (other = context->ring_list; other; other = other->next) {
+		if (&other->user_fence != uf &&
+		    other->user_fence.bo == uf->bo &&
+		    other->user_fence.offset == uf->offset) {
+			atomic_set(&other->user_fence.valid, 0);
+			return;
+		}
+	}
+
+	atomic_set(&uf->valid, 1);
+}
+
+static void amdgpu_cs_release_user_fence(struct amdgpu_cs_user_fence *uf)
+{
+	if (!uf->bo)
+		return;
+
+	if (uf->cpu)
+		amdgpu_bo_cpu_unmap(uf->bo);
+	amdgpu_bo_free(uf->bo);
+}
+
+/**
+ * Check a fence against the user fence location of its ring.
+ *
+ * Lock-free, costs a single read of the fence memory. Only values between
+ * the first and the last sequence number written by the ring are trusted,
+ * anything else is left to the accelerant.
+ *
+ * \param   fence - \c [in] Fence carrying the kernel sequence number
+ */
+static bool amdgpu_cs_user_fence_signaled(struct amdgpu_cs_fence *fence)
+{
+	struct amdgpu_cs_ring *ring;
+	struct amdgpu_cs_user_fence *uf;
+	uint64_t value;
+
+	ring = amdgpu_cs_get_ring(fence->context, fence->ip_type,
+				  fence->ip_instance, fence->ring);
+	if (!ring)
+		return false;
+
+	uf = &ring->user_fence;
+	if (!atomic_get(&uf->valid))
+		return false;
+
+	value = *uf->cpu;
+
+	return value >= fence->fence && value >= uf->first_seq &&
+	       value <= (uint64_t)atomic_get64((int64 *)&uf->last_seq);
+}
+
+/**
+ * Remember that \c fence has signaled. Submissions to a ring complete in
+ * order, so this covers every earlier sequence number of the ring as well.
+ */
+static void amdgpu_cs_mark_signaled(struct amdgpu_cs_fence *fence)
+{
+	struct amdgpu_cs_ring *ring;
+	int64 *last_signaled;
+	int64 old, prev;
+
+	ring = amdgpu_cs_get_ring(fence->context, fence->ip_type,
+				  fence->ip_instance, fence->ring);
+	if (!ring)
+		return;
+
+	last_signaled = (int64 *)&ring->last_signaled_seq;
+	old = atomic_get64(last_signaled);
+	while ((uint64_t)old < fence->fence) {
+		prev = atomic_test_and_set64(last_signaled, fence->fence, old);
+		if (prev == old)
+			break;
+		old = prev;
+	}
+}
+
+/**
+ * Add \c fence to the dependencies of a submission to the given ring.
+ *
+ * Fences known to have signaled and fences of the ring itself are
+ * dropped, fences of a ring that is already waited for only raise the
+ * sequence number waited for.
+ *
+ * \param   deps  - \c [in/out] Dependencies collected so far
+ * \param   count - \c [in]  Number of entries in \c deps
+ * \param   fence - \c [in]  Dependency to add
+ *
+ * \return  New number of entries in \c deps
+ */
+drm_private uint32_t amdgpu_cs_add_dependency(amdgpu_context_handle context,
+					      unsigned ip_type,
+					      unsigned ip_instance,
+					      uint32_t ring,
+					      struct amdgpu_cs_fence *deps,
+					      uint32_t count,
+					      const struct amdgpu_cs_fence *fence)
+{
+	struct amdgpu_cs_ring *fence_ring;
+	uint32_t i;
+
+	if (fence->fence == AMDGPU_NULL_SUBMIT_SEQ)
+		return count;
+
+	/* submissions to a ring execute in order */
+	if (fence->context == context && fence->ip_type == ip_type &&
+	    fence->ip_instance == ip_instance && fence->ring == ring)
+		return count;
+
+	fence_ring = amdgpu_cs_get_ring(fence->context, fence->ip_type,
+					fence->ip_instance, fence->ring);
+	if (fence_ring &&
+	    fence->fence <= (uint64_t)atomic_get64((int64 *)&fence_ring->last_signaled_seq))
+		return count;
+
+	for (i = 0; i < count; i++) {
+		if (deps[i].context == fence->context &&
+		    deps[i].ip_type == fence->ip_type &&
+		    deps[i].ip_instance == fence->ip_instance &&
+		    deps[i].ring == fence->ring) {
+			if (deps[i].fence < fence->fence)
+				deps[i].fence = fence->fence;
+			return count;
+		}
+	}
+
+	deps[count] = *fence;
+	return count + 1;
+}
+
+/**
+ * Build the chunks of a submission and pass them to the accelerant.
+ *
  * \param   context - \c [in]  GPU Context
- * \param   ibs_request - \c [in]  Pointer to submission requests
- * \param   fence - \c [out] return fence for this submission
+ * \param   ibs     - \c [in]  IBs to submit, all to the same ring
+ * \param   dependencies - \c [in]  Dependencies in kernel format
+ * \param   seq_no  - \c [out] Kernel sequence number of the submission
  *
  * \return  0 on success otherwise POSIX Error code
- * \sa amdgpu_cs_submit()
 */
-static int amdgpu_cs_submit_one(amdgpu_context_handle context,
-				struct amdgpu_cs_request *ibs_request)
+drm_private int amdgpu_cs_emit(amdgpu_context_handle context,
+			       unsigned ip_type, unsigned ip_instance,
+			       uint32_t ring, uint32_t bo_list_handle,
+			       uint32_t number_of_ibs,
+			       struct amdgpu_cs_ib_info *ibs,
+			       struct amdgpu_cs_fence_info *fence_info,
+			       uint32_t number_of_dependencies,
+			       struct drm_amdgpu_cs_chunk_dep *dependencies,
+			       uint64_t *seq_no)
 {
 	struct drm_amdgpu_cs_chunk *chunks;
 	struct drm_amdgpu_cs_chunk_data *chunk_data;
-	struct drm_amdgpu_cs_chunk_dep *dependencies = NULL;
-	struct drm_amdgpu_cs_chunk_dep *sem_dependencies = NULL;
-	amdgpu_device_handle dev = context->dev;
-	struct list_head *sem_list;
-	amdgpu_semaphore_handle sem, tmp;
-	uint32_t i, size, num_chunks, bo_list_handle = 0, sem_count = 0;
-	uint64_t seq_no;
+	uint32_t i, size, num_chunks;
+	uint64_t start;
 	bool user_fence;
-	int r = 0;
+	int r;
 
-	if (ibs_request->ip_type >= AMDGPU_HW_IP_NUM)
-		return EINVAL;
-	if (ibs_request->ring >= AMDGPU_CS_MAX_RINGS)
-		return EINVAL;
-	if (ibs_request->number_of_ibs == 0) {
-		ibs_request->seq_no = AMDGPU_NULL_SUBMIT_SEQ;
-		return 0;
-	}
-	user_fence = (ibs_request->fence_info.handle != NULL);
+	user_fence = (fence_info->handle != NULL);
 
-	size = ibs_request->number_of_ibs + (user_fence ? 2 : 1) + 1;
+	size = number_of_ibs + (user_fence ? 2 : 1) + 1;
 
 	chunks = alloca(sizeof(struct drm_amdgpu_cs_chunk) * size);
 
-	size = ibs_request->number_of_ibs + (user_fence ? 1 : 0);
+	size = number_of_ibs + (user_fence ? 1 : 0);
 
 	chunk_data = alloca(sizeof(struct drm_amdgpu_cs_chunk_data) * size);
 
-	if (ibs_request->resources)
-		bo_list_handle = ibs_request->resources->handle;
-	num_chunks = ibs_request->number_of_ibs;
+	num_chunks = number_of_ibs;
 	/* IB chunks */
-	for (i = 0; i < ibs_request->number_of_ibs; i++) {
+	for (i = 0; i < number_of_ibs; i++) {
 		struct amdgpu_cs_ib_info *ib;
 		chunks[i].chunk_id = AMDGPU_CHUNK_ID_IB;
 		chunks[i].length_dw = sizeof(struct drm_amdgpu_cs_chunk_ib) / 4;
 		chunks[i].chunk_data = (uint64_t)(uintptr_t)&chunk_data[i];
 
-		ib = &ibs_request->ibs[i];
+		ib = &ibs[i];
 
 		chunk_data[i].ib_data._pad = 0;
 		chunk_data[i].ib_data.va_start = ib->ib_mc_address;
 		chunk_data[i].ib_data.ib_bytes = ib->size * 4;
-		chunk_data[i].ib_data.ip_type = ibs_request->ip_type;
-		chunk_data[i].ib_data.ip_instance = ibs_request->ip_instance;
-		chunk_data[i].ib_data.ring = ibs_request->ring;
+		chunk_data[i].ib_data.ip_type = ip_type;
+		chunk_data[i].ib_data.ip_instance = ip_instance;
+		chunk_data[i].ib_data.ring = ring;
 		chunk_data[i].ib_data.flags = ib->flags;
 	}
 
-	pthread_mutex_lock(&context->sequence_mutex);
-
 	if (user_fence) {
 		i = num_chunks++;
 
@@ -281,79 +618,216 @@ static int amdgpu_cs_submit_one(amdgpu_context_handle context,
 		chunks[i].chunk_id = AMDGPU_CHUNK_ID_FENCE;
 		chunks[i].length_dw = sizeof(struct drm_amdgpu_cs_chunk_fence) / 4;
 		chunks[i].chunk_data = (uint64_t)(uintptr_t)&chunk_data[i];
-
-		/* fence bo handle */
-		chunk_data[i].fence_data.handle = ibs_request->fence_info.handle->handle;
-		/* offset */
-		chunk_data[i].fence_data.offset =
-			ibs_request->fence_info.offset * sizeof(uint64_t);
+		amdgpu_cs_chunk_fence_info_to_data(fence_info, &chunk_data[i]);
 	}
 
-	if (ibs_request->number_of_dependencies) {
-		dependencies = alloca(sizeof(struct drm_amdgpu_cs_chunk_dep) *
-			ibs_request->number_of_dependencies);
-		if (!dependencies) {
-			r = ENOMEM;
-			goto error_unlock;
-		}
-
-		for (i = 0; i < ibs_request->number_of_dependencies; ++i) {
-			struct amdgpu_cs_fence *info = &ibs_request->dependencies[i];
-			struct drm_amdgpu_cs_chunk_dep *dep = &dependencies[i];
-			dep->ip_type = info->ip_type;
-			dep->ip_instance = info->ip_instance;
-			dep->ring = info->ring;
-			dep->ctx_id = info->context->id;
-			dep->handle = info->fence;
-		}
-
+	if (number_of_dependencies) {
 		i = num_chunks++;
 
 		/* dependencies chunk */
 		chunks[i].chunk_id = AMDGPU_CHUNK_ID_DEPENDENCIES;
 		chunks[i].length_dw = sizeof(struct drm_amdgpu_cs_chunk_dep) / 4
-			* ibs_request->number_of_dependencies;
+			* number_of_dependencies;
 		chunks[i].chunk_data = (uint64_t)(uintptr_t)dependencies;
 	}
 
-	sem_list = &context->sem_list[ibs_request->ip_type][ibs_request->ip_instance][ibs_request->ring];
-	LIST_FOR_EACH_ENTRY(sem, sem_list, list)
-		sem_count++;
-	if (sem_count) {
-		sem_dependencies = alloca(sizeof(struct drm_amdgpu_cs_chunk_dep) * sem_count);
-		if (!sem_dependencies) {
+	start = amdgpu_cs_stats_start(context->dev);
+	r = amdgpu_cs_submit_raw2(context->dev, context, bo_list_handle,
+				  num_chunks, chunks, seq_no);
+	if (!r)
+		amdgpu_cs_stats_submission(context->dev, ip_type, ip_instance,
+					   ring, start, number_of_ibs, ibs,
+					   number_of_dependencies);
+	return r;
+}
+
+/**
+ * Pick the available ring of an IP with the fewest outstanding submissions.
+ *
+ * A submission counts as outstanding until a fence query or wait saw it
+ * or a later submission of the same ring signaled.
+ */
+static int amdgpu_cs_select_ring(amdgpu_context_handle context,
+				 unsigned ip_type, unsigned ip_instance,
+				 uint32_t *ring)
+{
+	atomic_t *ring_mask = &context->dev->ring_mask[ip_type][ip_instance];
+	uint64_t depth, best_depth = UINT64_MAX;
+	uint32_t mask, i;
+
+	mask = atomic_get(ring_mask);
+	if (!mask) {
+		struct drm_amdgpu_info_hw_ip info = {};
+		int r;
+
+		r = amdgpu_query_hw_ip_info(context->dev, ip_type, ip_instance,
+					    &info);
+		if (r)
+			return r;
+
+		/* without any ring the submission fails on ring 0 */
+		mask = info.available_rings ? info.available_rings : 1;
+		atomic_set(ring_mask, mask);
+	}
+
+	*ring = 0;
+	pthread_mutex_lock(&context->sequence_mutex);
+	for (i = 0; i < AMDGPU_CS_MAX_RINGS; i++) {
+		struct amdgpu_cs_ring *cs_ring;
+
+		if (!(mask & (1u << i)))
+			continue;
+
+		cs_ring = context->rings[ip_type][ip_instance][i];
+		depth = cs_ring ? cs_ring->last_seq -
+			(uint64_t)atomic_get64((int64 *)&cs_ring->last_signaled_seq) : 0;
+		if (depth < best_depth) {
+			best_depth = depth;
+			*ring = i;
+			if (!depth)
+				break;
+		}
+	}
+	pthread_mutex_unlock(&context->sequence_mutex);
+
+	return 0;
+}
+
+/**
+ * Submit command to kernel DRM
+ * \param   dev - \c [in]  Device handle
+ * \param   context - \c [in]  GPU Context
+ * \param   ibs_request - \c [in]  Pointer to submission requests
+ * \param   fence - \c [out] return fence for this submission
+ *
+ * \return  0 on success otherwise POSIX Error code
+ * \sa amdgpu_cs_submit()
+*/
+static int amdgpu_cs_submit_one(amdgpu_context_handle context,
+				struct amdgpu_cs_request *ibs_request)
+{
+	int r;
+
+	if (ibs_request->ip_type >= AMDGPU_HW_IP_NUM)
+		return EINVAL;
+	if (ibs_request->ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT)
+		return EINVAL;
+	if (ibs_request->ring == AMDGPU_CS_RING_AUTO) {
+		r = amdgpu_cs_select_ring(context, ibs_request->ip_type,
+					  ibs_request->ip_instance,
+					  &ibs_request->ring);
+		if (r)
+			return r;
+	}
+	if (ibs_request->ring >= AMDGPU_CS_MAX_RINGS)
+		return EINVAL;
+	if (ibs_request->number_of_ibs == 0) {
+		ibs_request->seq_no = AMDGPU_NULL_SUBMIT_SEQ;
+		return 0;
+	}
+
+	if (context->implicit_sync && ibs_request->resources)
+		return amdgpu_cs_implicit_sync_submit(context, ibs_request);
+
+	return amdgpu_cs_submit_request(context, ibs_request);
+}
+
+/**
+ * Queue or submit a validated request of a context.
+ *
+ * \param   context - \c [in]  GPU Context
+ * \param   ibs_request - \c [in/out]  Request, seq_no is set on success
+ *
+ * \return  0 on success otherwise POSIX Error code
+ */
+drm_private int amdgpu_cs_submit_request(amdgpu_context_handle context,
+					 struct amdgpu_cs_request *ibs_request)
+{
+	struct drm_amdgpu_cs_chunk_dep *dependencies = NULL;
+	struct amdgpu_cs_fence *fences = NULL;
+	struct amdgpu_cs_ring *ring;
+	struct amdgpu_cs_sem_deps *sem_deps;
+	uint32_t i, j, bo_list_handle = 0, num_deps = 0;
+	uint64_t seq_no;
+	int r = 0;
+
+	if (context->queue)
+		return amdgpu_cs_queue_submit(context, ibs_request);
+
+	if (ibs_request->resources)
+		bo_list_handle = ibs_request->resources->handle;
+
+	pthread_mutex_lock(&context->sequence_mutex);
+
+	ring = amdgpu_cs_create_ring(context, ibs_request->ip_type,
+				     ibs_request->ip_instance, ibs_request->ring);
+	if (!ring) {
+		r = ENOMEM;
+		goto error_unlock;
+	}
+	sem_deps = &ring->sem_deps;
+
+	if (ibs_request->number_of_dependencies + sem_deps->count) {
+		fences = alloca(sizeof(struct amdgpu_cs_fence) *
+			(ibs_request->number_of_dependencies + sem_deps->count));
+		if (!fences) {
 			r = ENOMEM;
 			goto error_unlock;
 		}
-		sem_count = 0;
-		LIST_FOR_EACH_ENTRY_SAFE(sem, tmp, sem_list, list) {
-			struct amdgpu_cs_fence *info = &sem->signal_fence;
-			struct drm_amdgpu_cs_chunk_dep *dep = &sem_dependencies[sem_count++];
-			dep->ip_type = info->ip_type;
-			dep->ip_instance = info->ip_instance;
-			dep->ring = info->ring;
-			dep->ctx_id = info->context->id;
-			dep->handle = info->fence;
-
-			list_del(&sem->list);
-			amdgpu_cs_reset_sem(sem);
-			amdgpu_cs_unreference_sem(sem);
+
+		for (i = 0; i < ibs_request->number_of_dependencies; ++i)
+			num_deps = amdgpu_cs_add_dependency(context,
+					ibs_request->ip_type,
+					ibs_request->ip_instance,
+					ibs_request->ring, fences, num_deps,
+					&ibs_request->dependencies[i]);
+
+		for (i = 0; i < sem_deps->count; ++i)
+			num_deps = amdgpu_cs_add_dependency(context,
+					ibs_request->ip_type,
+					ibs_request->ip_instance,
+					ibs_request->ring, fences, num_deps,
+					&sem_deps->fences[i]);
+		sem_deps->count = 0;
+	}
+
+	if (num_deps) {
+		dependencies = alloca(sizeof(struct drm_amdgpu_cs_chunk_dep) *
+				      num_deps);
+		if (!dependencies) {
+			r = ENOMEM;
+			goto error_unlock;
 		}
-		i = num_chunks++;
 
-		/* dependencies chunk */
-		chunks[i].chunk_id = AMDGPU_CHUNK_ID_DEPENDENCIES;
-		chunks[i].length_dw = sizeof(struct drm_amdgpu_cs_chunk_dep) / 4 * sem_count;
-		chunks[i].chunk_data = (uint64_t)(uintptr_t)sem_dependencies;
+		/* the fences were queued before this request, so their
+		 * workers submit them without waiting for it */
+		for (i = 0, j = 0; i < num_deps; ++i) {
+			r = amdgpu_cs_fence_to_dep(&fences[i],
+						   AMDGPU_TIMEOUT_INFINITE,
+						   &dependencies[j]);
+			if (r)
+				goto error_unlock;
+			if (dependencies[j].handle != AMDGPU_NULL_SUBMIT_SEQ)
+				j++;
+		}
+		num_deps = j;
 	}
 
-	r = amdgpu_cs_submit_raw2(dev, context, bo_list_handle, num_chunks,
-				  chunks, &seq_no);
+	r = amdgpu_cs_emit(context, ibs_request->ip_type,
+			   ibs_request->ip_instance, ibs_request->ring,
+			   bo_list_handle, ibs_request->number_of_ibs,
+			   ibs_request->ibs, &ibs_request->fence_info,
+			   num_deps, dependencies, &seq_no);
 	if (r)
 		goto error_unlock;
 
 	ibs_request->seq_no = seq_no;
-	context->last_seq[ibs_request->ip_type][ibs_request->ip_instance][ibs_request->ring] = ibs_request->seq_no;
+	ring->last_seq = ibs_request->seq_no;
+	if (ibs_request->fence_info.handle)
+		amdgpu_cs_record_user_fence(context, ibs_request->ip_type,
+					    ibs_request->ip_instance,
+					    ibs_request->ring,
+					    &ibs_request->fence_info, seq_no);
 error_unlock:
 	pthread_mutex_unlock(&context->sequence_mutex);
 	return r;
@@ -364,6 +838,7 @@ drm_public int amdgpu_cs_submit(amdgpu_context_handle context,
 				struct amdgpu_cs_request *ibs_request,
 				uint32_t number_of_requests)
 {
+	uint64_t start;
 	uint32_t i;
 	int r;
 
@@ -372,41 +847,83 @@ drm_public int amdgpu_cs_submit(amdgpu_context_handle context,
 
 	r = 0;
 	for (i = 0; i < number_of_requests; i++) {
+		start = amdgpu_cs_stats_start(context->dev);
 		r = amdgpu_cs_submit_one(context, ibs_request);
 		if (r)
 			break;
+		amdgpu_cs_stats_request(context->dev, ibs_request->ip_type,
+					ibs_request->ip_instance,
+					ibs_request->ring, start);
 		ibs_request++;
 	}
 
 	return r;
 }
 
+/* Calls of amdgpu_cs_coarse_time() served from the cached clock. */
+#define AMDGPU_CS_COARSE_CLOCK_CALLS 16
+
+static __thread uint64_t coarse_time_ns;
+static __thread unsigned coarse_time_calls;
+
+/**
+ * Read CLOCK_MONOTONIC.
+ *
+ * \return  current time in nanoseconds
+ */
+drm_private uint64_t amdgpu_cs_current_time(void)
+{
+	struct timespec current;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &current))
+		return 0;
+
+	coarse_time_ns = (uint64_t)current.tv_sec * 1000000000ull +
+			 current.tv_nsec;
+	coarse_time_calls = AMDGPU_CS_COARSE_CLOCK_CALLS;
+	return coarse_time_ns;
+}
+
+/**
+ * Cheap CLOCK_MONOTONIC for polling loops. The clock is read only every
+ * AMDGPU_CS_COARSE_CLOCK_CALLS calls by the same thread, the time
+ * returned in between lags behind.
+ *
+ * \return  current time in nanoseconds
+ */
+drm_private uint64_t amdgpu_cs_coarse_time(void)
+{
+	if (!coarse_time_calls)
+		return amdgpu_cs_current_time();
+
+	coarse_time_calls--;
+	return coarse_time_ns;
+}
+
 /**
  * Calculate absolute timeout.
  *
+ * A timeout of 0 stays 0, which is in the past, so polling never reads
+ * the clock.
+ *
  * \param   timeout - \c [in] timeout in nanoseconds.
  *
  * \return  absolute timeout in nanoseconds
 */
 drm_private uint64_t amdgpu_cs_calculate_timeout(uint64_t timeout)
 {
-	int r;
+	uint64_t current_ns;
 
-	if (timeout != AMDGPU_TIMEOUT_INFINITE) {
-		struct timespec current;
-		uint64_t current_ns;
-		r = clock_gettime(CLOCK_MONOTONIC, &current);
-		if (r) {
-			fprintf(stderr, "clock_gettime() returned error (%d)!", errno);
-			return AMDGPU_TIMEOUT_INFINITE;
-		}
+	if (!timeout || timeout == AMDGPU_TIMEOUT_INFINITE)
+		return timeout;
 
-		current_ns = ((uint64_t)current.tv_sec) * 1000000000ull;
-		current_ns += current.tv_nsec;
-		timeout += current_ns;
-		if (timeout < current_ns)
-			timeout = AMDGPU_TIMEOUT_INFINITE;
-	}
+	current_ns = amdgpu_cs_current_time();
+	if (!current_ns)
+		return AMDGPU_TIMEOUT_INFINITE;
+
+	timeout += current_ns;
+	if (timeout < current_ns)
+		timeout = AMDGPU_TIMEOUT_INFINITE;
 	return timeout;
 }
 
@@ -420,13 +937,16 @@ static int amdgpu_ioctl_wait_cs(amdgpu_context_handle context,
 				bool *busy)
 {
 	amdgpu_device_handle dev = context->dev;
+	uint64_t start;
 	int r;
 
 	if (!(flags & AMDGPU_QUERY_FENCE_TIMEOUT_IS_ABSOLUTE)) {
 		timeout_ns = amdgpu_cs_calculate_timeout(timeout_ns);
 	}
 
+	start = amdgpu_cs_stats_start(dev);
 	r = dev->acc_amdgpu->vt->AmdgpuWaitCs(dev->acc_amdgpu, context->id, ip, ip_instance, ring, handle, timeout_ns, busy);
+	amdgpu_cs_stats_wait(dev, ip, ip_instance, ring, start);
 
 	return r;
 }
@@ -436,6 +956,8 @@ drm_public int amdgpu_cs_query_fence_status(struct amdgpu_cs_fence *fence,
 					    uint64_t flags,
 					    uint32_t *expired)
 {
+	struct amdgpu_cs_fence kernel_fence;
+	struct amdgpu_cs_ring *ring;
 	bool busy = true;
 	int r;
 
@@ -443,6 +965,8 @@ drm_public int amdgpu_cs_query_fence_status(struct amdgpu_cs_fence *fence,
 		return EINVAL;
 	if (fence->ip_type >= AMDGPU_HW_IP_NUM)
 		return EINVAL;
+	if (fence->ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT)
+		return EINVAL;
 	if (fence->ring >= AMDGPU_CS_MAX_RINGS)
 		return EINVAL;
 	if (fence->fence == AMDGPU_NULL_SUBMIT_SEQ) {
@@ -450,18 +974,127 @@ drm_public int amdgpu_cs_query_fence_status(struct amdgpu_cs_fence *fence,
 		return 0;
 	}
 
+	ring = amdgpu_cs_get_ring(fence->context, fence->ip_type,
+				  fence->ip_instance, fence->ring);
+	if (ring &&
+	    fence->fence <= (uint64_t)atomic_get64((int64 *)&ring->last_signaled_seq)) {
+		*expired = true;
+		return 0;
+	}
+
 	*expired = false;
 
+	kernel_fence = *fence;
+	if (fence->context->queue) {
+		/* wait for the worker with the same deadline as for the GPU */
+		if (!(flags & AMDGPU_QUERY_FENCE_TIMEOUT_IS_ABSOLUTE)) {
+			timeout_ns = amdgpu_cs_calculate_timeout(timeout_ns);
+			flags |= AMDGPU_QUERY_FENCE_TIMEOUT_IS_ABSOLUTE;
+		}
+
+		r = amdgpu_cs_queue_translate(fence, timeout_ns,
+					      &kernel_fence.fence);
+		if (r == ETIME)
+			return 0;
+		if (r)
+			return r;
+
+		/* the submission failed, nothing left to wait for. Earlier
+		 * submissions on the ring may still run, so the ring state is
+		 * left alone. */
+		if (kernel_fence.fence == AMDGPU_NULL_SUBMIT_SEQ) {
+			*expired = true;
+			return 0;
+		}
+	}
+
+	if (amdgpu_cs_user_fence_signaled(&kernel_fence)) {
+		amdgpu_cs_mark_signaled(fence);
+		*expired = true;
+		return 0;
+	}
+
 	r = amdgpu_ioctl_wait_cs(fence->context, fence->ip_type,
 				fence->ip_instance, fence->ring,
-			       	fence->fence, timeout_ns, flags, &busy);
+			       	kernel_fence.fence, timeout_ns, flags, &busy);
 
-	if (!r && !busy)
+	if (!r && !busy) {
+		amdgpu_cs_mark_signaled(fence);
 		*expired = true;
+	}
 
 	return r;
 }
 
+drm_public int amdgpu_cs_wait_fences_deadline(struct amdgpu_cs_fence *fences,
+					      uint32_t fence_count,
+					      bool wait_all,
+					      uint64_t deadline_ns,
+					      uint32_t *status,
+					      uint32_t *first)
+{
+	const uint64_t flags = AMDGPU_QUERY_FENCE_TIMEOUT_IS_ABSOLUTE;
+	uint64_t slice = AMDGPU_CS_WAIT_ANY_SLICE_MIN_NS, slice_deadline;
+	uint32_t i, expired, next = 0;
+	int r;
+
+	if (!fences || !fence_count || !status)
+		return EINVAL;
+
+	*status = 0;
+
+	if (wait_all) {
+		for (i = 0; i < fence_count; i++) {
+			r = amdgpu_cs_query_fence_status(&fences[i], deadline_ns,
+							 flags, &expired);
+			if (r)
+				return r;
+			if (!expired)
+				return 0;
+		}
+		*status = 1;
+		return 0;
+	}
+
+	for (;;) {
+		/* an absolute timeout of 0 polls */
+		for (i = 0; i < fence_count; i++) {
+			r = amdgpu_cs_query_fence_status(&fences[i], 0, flags,
+							 &expired);
+			if (r)
+				return r;
+			if (expired) {
+				*status = 1;
+				if (first)
+					*first = i;
+				return 0;
+			}
+		}
+
+		if (deadline_ns != AMDGPU_TIMEOUT_INFINITE &&
+		    amdgpu_cs_coarse_time() >= deadline_ns)
+			return 0;
+
+		/* block on the fences in turn, for slices growing up to
+		 * AMDGPU_CS_WAIT_ANY_SLICE_MAX_NS */
+		slice_deadline = MIN2(amdgpu_cs_calculate_timeout(slice),
+				      deadline_ns);
+		r = amdgpu_cs_query_fence_status(&fences[next], slice_deadline,
+						 flags, &expired);
+		if (r)
+			return r;
+		if (expired) {
+			*status = 1;
+			if (first)
+				*first = next;
+			return 0;
+		}
+
+		next = (next + 1) % fence_count;
+		slice = MIN2(slice * 2, AMDGPU_CS_WAIT_ANY_SLICE_MAX_NS);
+	}
+}
+
 drm_public int amdgpu_cs_wait_fences(struct amdgpu_cs_fence *fences,
 				     uint32_t fence_count,
 				     bool wait_all,
@@ -469,7 +1102,9 @@ drm_public int amdgpu_cs_wait_fences(struct amdgpu_cs_fence *fences,
 				     uint32_t *status,
 				     uint32_t *first)
 {
-	return ENOSYS;
+	return amdgpu_cs_wait_fences_deadline(fences, fence_count, wait_all,
+					      amdgpu_cs_calculate_timeout(timeout_ns),
+					      status, first);
 }
 
 drm_public int amdgpu_cs_create_semaphore(amdgpu_semaphore_handle *sem)
@@ -479,9 +1114,21 @@ drm_public int amdgpu_cs_create_semaphore(amdgpu_semaphore_handle *sem)
 	if (!sem)
 		return EINVAL;
 
-	gpu_semaphore = calloc(1, sizeof(struct amdgpu_semaphore));
-	if (!gpu_semaphore)
-		return ENOMEM;
+	pthread_mutex_lock(&sem_pool_mutex);
+	if (sem_pool_count) {
+		gpu_semaphore = LIST_FIRST_ENTRY(&sem_pool, struct amdgpu_semaphore, list);
+		list_del(&gpu_semaphore->list);
+		sem_pool_count--;
+	} else {
+		gpu_semaphore = NULL;
+	}
+	pthread_mutex_unlock(&sem_pool_mutex);
+
+	if (!gpu_semaphore) {
+		gpu_semaphore = calloc(1, sizeof(struct amdgpu_semaphore));
+		if (!gpu_semaphore)
+			return ENOMEM;
+	}
 
 	atomic_set(&gpu_semaphore->refcount, 1);
 	*sem = gpu_semaphore;
@@ -495,21 +1142,26 @@ drm_public int amdgpu_cs_signal_semaphore(amdgpu_context_handle ctx,
 			       uint32_t ring,
 			       amdgpu_semaphore_handle sem)
 {
+	struct amdgpu_cs_ring *cs_ring;
+
 	if (!ctx || !sem)
 		return EINVAL;
 	if (ip_type >= AMDGPU_HW_IP_NUM)
 		return EINVAL;
+	if (ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT)
+		return EINVAL;
 	if (ring >= AMDGPU_CS_MAX_RINGS)
 		return EINVAL;
 	/* sem has been signaled */
 	if (sem->signal_fence.context)
 		return EINVAL;
 	pthread_mutex_lock(&ctx->sequence_mutex);
+	cs_ring = ctx->rings[ip_type][ip_instance][ring];
 	sem->signal_fence.context = ctx;
 	sem->signal_fence.ip_type = ip_type;
 	sem->signal_fence.ip_instance = ip_instance;
 	sem->signal_fence.ring = ring;
-	sem->signal_fence.fence = ctx->last_seq[ip_type][ip_instance][ring];
+	sem->signal_fence.fence = cs_ring ? cs_ring->last_seq : 0;
 	update_references(NULL, &sem->refcount);
 	pthread_mutex_unlock(&ctx->sequence_mutex);
 	return 0;
@@ -521,19 +1173,46 @@ drm_public int amdgpu_cs_wait_semaphore(amdgpu_context_handle ctx,
 			     uint32_t ring,
 			     amdgpu_semaphore_handle sem)
 {
+	struct amdgpu_cs_ring *cs_ring;
+	struct amdgpu_cs_sem_deps *sem_deps;
+
 	if (!ctx || !sem)
 		return EINVAL;
 	if (ip_type >= AMDGPU_HW_IP_NUM)
 		return EINVAL;
 	if (ring >= AMDGPU_CS_MAX_RINGS)
 		return EINVAL;
+	if (ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT)
+		return EINVAL;
 	/* must signal first */
 	if (!sem->signal_fence.context)
 		return EINVAL;
 
 	pthread_mutex_lock(&ctx->sequence_mutex);
-	list_add(&sem->list, &ctx->sem_list[ip_type][ip_instance][ring]);
+	cs_ring = amdgpu_cs_create_ring(ctx, ip_type, ip_instance, ring);
+	if (!cs_ring) {
+		pthread_mutex_unlock(&ctx->sequence_mutex);
+		return ENOMEM;
+	}
+	sem_deps = &cs_ring->sem_deps;
+	if (sem_deps->count == sem_deps->size) {
+		uint32_t size = sem_deps->size ? sem_deps->size * 2 : 4;
+		struct amdgpu_cs_fence *fences;
+
+		fences = realloc(sem_deps->fences, sizeof(*fences) * size);
+		if (!fences) {
+			pthread_mutex_unlock(&ctx->sequence_mutex);
+			return ENOMEM;
+		}
+		sem_deps->fences = fences;
+		sem_deps->size = size;
+	}
+	/* the wait consumes the signal, the semaphore is free again */
+	sem_deps->fences[sem_deps->count++] = sem->signal_fence;
 	pthread_mutex_unlock(&ctx->sequence_mutex);
+
+	amdgpu_cs_reset_sem(sem);
+	amdgpu_cs_unreference_sem(sem);
 	return 0;
 }
 
@@ -556,8 +1235,16 @@ static int amdgpu_cs_unreference_sem(amdgpu_semaphore_handle sem)
 	if (!sem)
 		return EINVAL;
 
-	if (update_references(&sem->refcount, NULL))
+	if (update_references(&sem->refcount, NULL)) {
+		pthread_mutex_lock(&sem_pool_mutex);
+		if (sem_pool_count < AMDGPU_CS_SEM_POOL_MAX) {
+			list_add(&sem->list, &sem_pool);
+			sem_pool_count++;
+			sem = NULL;
+		}
+		pthread_mutex_unlock(&sem_pool_mutex);
 		free(sem);
+	}
 	return 0;
 }
 
@@ -829,14 +1516,45 @@ drm_public void amdgpu_cs_chunk_fence_info_to_data(struct amdgpu_cs_fence_info *
 	data->fence_data.offset = fence_info->offset * sizeof(uint64_t);
 }
 
-drm_public void amdgpu_cs_chunk_fence_to_dep(struct amdgpu_cs_fence *fence,
-					struct drm_amdgpu_cs_chunk_dep *dep)
+/**
+ * Convert a fence to a dependency, translating the sequence numbers of
+ * asynchronous contexts to the kernel ones.
+ *
+ * \param   abs_timeout - \c [in]  Absolute timeout for the worker of the
+ *				    fence's context to submit it
+ *
+ * \return  0 on success, ETIME if the fence is still queued, otherwise
+ *	    POSIX Error code. \c dep is only written on success, its handle
+ *	    is AMDGPU_NULL_SUBMIT_SEQ if the submission failed.
+ */
+drm_private int amdgpu_cs_fence_to_dep(struct amdgpu_cs_fence *fence,
+				       uint64_t abs_timeout,
+				       struct drm_amdgpu_cs_chunk_dep *dep)
 {
+	uint64_t seq_no = fence->fence;
+	int r;
+
+	/* asynchronous contexts hand out their own sequence numbers */
+	if (fence->context->queue && fence->fence != AMDGPU_NULL_SUBMIT_SEQ) {
+		r = amdgpu_cs_queue_translate(fence, abs_timeout, &seq_no);
+		if (r)
+			return r;
+	}
+
 	dep->ip_type = fence->ip_type;
 	dep->ip_instance = fence->ip_instance;
 	dep->ring = fence->ring;
 	dep->ctx_id = fence->context->id;
-	dep->handle = fence->fence;
+	dep->handle = seq_no;
+	return 0;
+}
+
+drm_public int amdgpu_cs_chunk_fence_to_dep(struct amdgpu_cs_fence *fence,
+					    struct drm_amdgpu_cs_chunk_dep *dep)
+{
+	return amdgpu_cs_fence_to_dep(fence,
+			amdgpu_cs_calculate_timeout(AMDGPU_CS_DEP_TIMEOUT_NS),
+			dep);
 }
 
 drm_public int amdgpu_cs_fence_to_handle(amdgpu_device_handle dev,
@@ -0,0 +1,274 @@
+/**
+ * \file amdgpu_cs_ib_ring.c
+ *
+ *  IB ring allocator. IB space is carved linearly from one CPU and GPU
+ *  mapped buffer and reclaimed in allocation order once the fences of the
+ *  submissions using it signaled.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+/**
+ * Allocations up to \c end, guarded by \c fence.
+ */
+struct amdgpu_ib_ring_region {
+	uint64_t end;
+	struct amdgpu_cs_fence fence;
+};
+
+struct amdgpu_ib_ring {
+	amdgpu_context_handle context;
+	amdgpu_bo_handle bo;
+	amdgpu_va_handle va_handle;
+	uint64_t va;
+	uint8_t *cpu;
+	uint64_t size;
+	uint32_t start_alignment;
+	uint32_t size_alignment;
+
+	pthread_mutex_t mutex;
+	/* Positions only grow, the buffer offset is position % size. */
+	uint64_t head;
+	uint64_t tail;
+	/** End of the allocations already covered by a region. */
+	uint64_t fenced;
+	/** Fenced regions, oldest first, in a circular array. */
+	uint32_t first_region;
+	uint32_t num_regions;
+	uint32_t max_regions;
+	struct amdgpu_ib_ring_region *regions;
+};
+
+/**
+ * Release the oldest region, waiting for its fence if \c wait is set.
+ *
+ * \return  0 on success, EBUSY if the fence has not signaled and \c wait
+ *	    is not set, otherwise POSIX Error code
+ */
+static int amdgpu_cs_ib_ring_retire(amdgpu_ib_ring_handle ib_ring, bool wait)
+{
+	struct amdgpu_ib_ring_region *region;
+	uint32_t expired = 0;
+	int r;
+
+	region = &ib_ring->regions[ib_ring->first_region];
+	r = amdgpu_cs_query_fence_status(&region->fence,
+					 wait ? AMDGPU_TIMEOUT_INFINITE : 0,
+					 0, &expired);
+	if (r)
+		return r;
+	if (!expired)
+		return EBUSY;
+
+	ib_ring->tail = region->end;
+	ib_ring->first_region = (ib_ring->first_region + 1) % ib_ring->max_regions;
+	ib_ring->num_regions--;
+	return 0;
+}
+
+drm_public int amdgpu_cs_ib_ring_create(amdgpu_context_handle context,
+					unsigned ip_type,
+					unsigned ip_instance,
+					uint64_t size,
+					amdgpu_ib_ring_handle *ib_ring)
+{
+	struct drm_amdgpu_info_hw_ip info = {};
+	struct amdgpu_bo_alloc_request request = {};
+	struct amdgpu_ib_ring *ring;
+	uint32_t page_size = getpagesize();
+	void *cpu;
+	int r;
+
+	if (!context || !ib_ring || !size)
+		return EINVAL;
+
+	r = amdgpu_query_hw_ip_info(context->dev, ip_type, ip_instance, &info);
+	if (r)
+		return r;
+
+	ring = calloc(1, sizeof(struct amdgpu_ib_ring));
+	if (!ring)
+		return ENOMEM;
+
+	ring->context = context;
+	ring->start_alignment = MAX2(info.ib_start_alignment, 4);
+	ring->size_alignment = MAX2(info.ib_size_alignment, 4);
+	/* keeps every start alignment valid across the wrap */
+	ring->size = ALIGN(size, MAX2(ring->start_alignment, page_size));
+
+	request.alloc_size = ring->size;
+	request.phys_alignment = page_size;
+	request.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+	r = amdgpu_bo_alloc(context->dev, &request, &ring->bo);
+	if (r)
+		goto error_free;
+
+	r = amdgpu_va_range_alloc(context->dev, amdgpu_gpu_va_range_general,
+				  ring->size, page_size, 0, &ring->va,
+				  &ring->va_handle, 0);
+	if (r)
+		goto error_bo;
+
+	r = amdgpu_bo_va_op(ring->bo, 0, ring->size, ring->va, 0,
+			    AMDGPU_VA_OP_MAP);
+	if (r)
+		goto error_va;
+
+	r = amdgpu_bo_cpu_map(ring->bo, &cpu);
+	if (r)
+		goto error_map;
+	ring->cpu = cpu;
+
+	pthread_mutex_init(&ring->mutex, NULL);
+	*ib_ring = ring;
+	return 0;
+
+error_map:
+	amdgpu_bo_va_op(ring->bo, 0, ring->size, ring->va, 0,
+			AMDGPU_VA_OP_UNMAP);
+error_va:
+	amdgpu_va_range_free(ring->va_handle);
+error_bo:
+	amdgpu_bo_free(ring->bo);
+error_free:
+	free(ring);
+	return r;
+}
+
+drm_public int amdgpu_cs_ib_ring_destroy(amdgpu_ib_ring_handle ib_ring)
+{
+	int r = 0;
+
+	if (!ib_ring)
+		return EINVAL;
+
+	/* the GPU may still read the IBs */
+	while (ib_ring->num_regions && !r)
+		r = amdgpu_cs_ib_ring_retire(ib_ring, true);
+
+	amdgpu_bo_cpu_unmap(ib_ring->bo);
+	amdgpu_bo_va_op(ib_ring->bo, 0, ib_ring->size, ib_ring->va, 0,
+			AMDGPU_VA_OP_UNMAP);
+	amdgpu_va_range_free(ib_ring->va_handle);
+	amdgpu_bo_free(ib_ring->bo);
+	pthread_mutex_destroy(&ib_ring->mutex);
+	free(ib_ring->regions);
+	free(ib_ring);
+	return r;
+}
+
+drm_public int amdgpu_cs_ib_ring_alloc(amdgpu_ib_ring_handle ib_ring,
+				       uint32_t size_dw,
+				       struct amdgpu_cs_ib_info *ib,
+				       void **cpu)
+{
+	struct amdgpu_cs_fence fence;
+	uint64_t size, pos;
+	uint32_t expired;
+	int r = 0;
+
+	if (!ib_ring || !ib || !cpu || !size_dw)
+		return EINVAL;
+
+	size = ALIGN((uint64_t)size_dw * 4, ib_ring->size_alignment);
+	if (size > ib_ring->size)
+		return EINVAL;
+
+	pthread_mutex_lock(&ib_ring->mutex);
+
+	/* free signaled regions first, then wait for the oldest ones */
+	for (;;) {
+		pos = ALIGN(ib_ring->head, ib_ring->start_alignment);
+		/* IBs don't wrap, skip the rest of the buffer */
+		if (pos % ib_ring->size + size > ib_ring->size)
+			pos = (pos / ib_ring->size + 1) * ib_ring->size;
+
+		if (pos + size - ib_ring->tail <= ib_ring->size)
+			break;
+
+		if (!ib_ring->num_regions) {
+			/* filled by allocations nobody fenced yet */
+			r = ENOMEM;
+			goto out;
+		}
+
+		r = amdgpu_cs_ib_ring_retire(ib_ring, false);
+		if (r == EBUSY) {
+			/* other threads keep allocating and fencing meanwhile,
+			 * the region is retired on the next iteration */
+			fence = ib_ring->regions[ib_ring->first_region].fence;
+			pthread_mutex_unlock(&ib_ring->mutex);
+			r = amdgpu_cs_query_fence_status(&fence,
+							 AMDGPU_TIMEOUT_INFINITE,
+							 0, &expired);
+			pthread_mutex_lock(&ib_ring->mutex);
+		}
+		if (r)
+			goto out;
+	}
+
+	ib_ring->head = pos + size;
+	ib->ib_mc_address = ib_ring->va + pos % ib_ring->size;
+	ib->size = size / 4;
+	*cpu = ib_ring->cpu + pos % ib_ring->size;
+
+out:
+	pthread_mutex_unlock(&ib_ring->mutex);
+	return r;
+}
+
+drm_public int amdgpu_cs_ib_ring_fence(amdgpu_ib_ring_handle ib_ring,
+				       struct amdgpu_cs_fence *fence)
+{
+	struct amdgpu_ib_ring_region *region;
+	int r = 0;
+
+	if (!ib_ring || !fence)
+		return EINVAL;
+
+	pthread_mutex_lock(&ib_ring->mutex);
+
+	if (ib_ring->fenced == ib_ring->head)
+		goto out;
+
+	if (ib_ring->num_regions == ib_ring->max_regions) {
+		uint32_t max_regions = ib_ring->max_regions ? ib_ring->max_regions * 2 : 16;
+		struct amdgpu_ib_ring_region *regions;
+		uint32_t i;
+
+		regions = malloc(sizeof(*regions) * max_regions);
+		if (!regions) {
+			r = ENOMEM;
+			goto out;
+		}
+		for (i = 0; i < ib_ring->num_regions; i++)
+			regions[i] = ib_ring->regions[(ib_ring->first_region + i) %
+						      ib_ring->max_regions];
+
+		free(ib_ring->regions);
+		ib_ring->regions = regions;
+		ib_ring->first_region = 0;
+		ib_ring->max_regions = max_regions;
+	}
+
+	region = &ib_ring->regions[(ib_ring->first_region + ib_ring->num_regions) %
+				   ib_ring->max_regions];
+	region->end = ib_ring->head;
+	region->fence = *fence;
+	ib_ring->num_regions++;
+	ib_ring->fenced = ib_ring->head;
+
+out:
+	pthread_mutex_unlock(&ib_ring->mutex);
+	return r;
+}
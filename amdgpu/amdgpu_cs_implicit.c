@@ -0,0 +1,325 @@
+/**
+ * \file amdgpu_cs_implicit.c
+ *
+ *  Implicit synchronization. Submissions of contexts that enable it wait
+ *  for the last write to every BO of their resource list and, if they
+ *  write it, for the reads since. The fences are tracked per BO by the
+ *  library because the accelerant does not synchronize on BO usage.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+
+/* Serials are unique across devices, pooled contexts move between them */
+static uint64_t implicit_sync_serial;
+
+drm_private void amdgpu_cs_implicit_sync_init(amdgpu_device_handle dev)
+{
+	pthread_mutex_init(&dev->implicit_sync_mutex, NULL);
+	list_inithead(&dev->implicit_sync_zombies);
+}
+
+drm_private void amdgpu_cs_implicit_sync_fini(amdgpu_device_handle dev)
+{
+	struct amdgpu_context *context, *next;
+
+	/* the kernel contexts go away with the accelerant, queued
+	 * submissions are still handed to it */
+	LIST_FOR_EACH_ENTRY_SAFE(context, next, &dev->implicit_sync_zombies,
+				 implicit_sync_link) {
+		list_del(&context->implicit_sync_link);
+		if (context->queue)
+			amdgpu_cs_queue_destroy(context);
+		amdgpu_cs_ctx_release(context);
+	}
+
+	pthread_mutex_destroy(&dev->implicit_sync_mutex);
+}
+
+/**
+ * Check that a recorded fence may still be waited for, i.e. its context
+ * was not freed and reused since. Contexts that recorded fences are never
+ * freed, only pooled, so \c fence.context stays readable.
+ *
+ * Must be called with implicit_sync_mutex held.
+ */
+static bool amdgpu_cs_implicit_sync_live(amdgpu_device_handle dev,
+					 const struct amdgpu_bo_sync_fence *f)
+{
+	return f->serial && f->fence.context->implicit_sync_serial == f->serial;
+}
+
+/**
+ * Check that a recorded fence needs no waiting anymore.
+ *
+ * Must be called with implicit_sync_mutex held.
+ */
+static bool amdgpu_cs_implicit_sync_idle(amdgpu_device_handle dev,
+					 const struct amdgpu_bo_sync_fence *f)
+{
+	struct amdgpu_cs_ring *ring;
+
+	if (!amdgpu_cs_implicit_sync_live(dev, f))
+		return true;
+
+	ring = amdgpu_cs_get_ring(f->fence.context, f->fence.ip_type,
+				  f->fence.ip_instance, f->fence.ring);
+	return ring && f->fence.fence <=
+		(uint64_t)atomic_get64((int64 *)&ring->last_signaled_seq);
+}
+
+static bool amdgpu_cs_implicit_sync_same_ring(const struct amdgpu_cs_fence *a,
+					      const struct amdgpu_cs_fence *b)
+{
+	return a->context == b->context && a->ip_type == b->ip_type &&
+	       a->ip_instance == b->ip_instance && a->ring == b->ring;
+}
+
+/**
+ * Check without blocking that all submissions of a context completed.
+ * Requests still queued by an asynchronous context count as running.
+ */
+static bool amdgpu_cs_implicit_sync_ctx_idle(amdgpu_context_handle context)
+{
+	struct amdgpu_cs_fence fence = {};
+	struct amdgpu_cs_ring *ring;
+	uint32_t expired;
+	unsigned ip, inst;
+
+	fence.context = context;
+	for (ip = 0; ip < AMDGPU_HW_IP_NUM; ip++) {
+		for (inst = 0; inst < AMDGPU_HW_IP_INSTANCE_MAX_COUNT; inst++) {
+			for (fence.ring = 0; fence.ring < AMDGPU_CS_MAX_RINGS;
+			     fence.ring++) {
+				ring = context->rings[ip][inst][fence.ring];
+				if (!ring || ring->last_seq <=
+				    (uint64_t)atomic_get64((int64 *)&ring->last_signaled_seq))
+					continue;
+
+				fence.ip_type = ip;
+				fence.ip_instance = inst;
+				fence.fence = ring->last_seq;
+				if (amdgpu_cs_query_fence_status(&fence, 0, 0,
+								 &expired) ||
+				    !expired)
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Free the kernel contexts of freed contexts whose submissions completed.
+ *
+ * Must be called with implicit_sync_mutex held.
+ */
+static void amdgpu_cs_implicit_sync_reap(amdgpu_device_handle dev)
+{
+	struct amdgpu_context *context, *next;
+
+	LIST_FOR_EACH_ENTRY_SAFE(context, next, &dev->implicit_sync_zombies,
+				 implicit_sync_link) {
+		if (!amdgpu_cs_implicit_sync_ctx_idle(context))
+			continue;
+
+		list_del(&context->implicit_sync_link);
+		context->implicit_sync_serial = 0;
+		amdgpu_cs_ctx_destroy(context);
+	}
+}
+
+/**
+ * Record a read of \c bo by the submission \c f.
+ *
+ * A later read from the same ring replaces the earlier one, reads that
+ * completed already are dropped.
+ */
+static void amdgpu_cs_implicit_sync_read(struct amdgpu_bo *bo,
+					 const struct amdgpu_bo_sync_fence *f)
+{
+	struct amdgpu_bo_sync *sync = &bo->sync;
+	uint32_t i, count = 0;
+
+	for (i = 0; i < sync->num_reads; i++) {
+		if (amdgpu_cs_implicit_sync_same_ring(&sync->reads[i].fence,
+						      &f->fence) ||
+		    amdgpu_cs_implicit_sync_idle(bo->dev, &sync->reads[i]))
+			continue;
+		sync->reads[count++] = sync->reads[i];
+	}
+	sync->num_reads = count;
+
+	if (sync->num_reads == sync->max_reads) {
+		uint32_t max_reads = sync->max_reads ? sync->max_reads * 2 : 4;
+		struct amdgpu_bo_sync_fence *reads;
+
+		reads = realloc(sync->reads, sizeof(*reads) * max_reads);
+		if (!reads) {
+			/* the read waited for the last write, so later
+			 * accesses waiting for it wait for that write too */
+			sync->write = *f;
+			return;
+		}
+		sync->reads = reads;
+		sync->max_reads = max_reads;
+	}
+
+	sync->reads[sync->num_reads++] = *f;
+}
+
+/**
+ * Submit a request of an implicitly synchronized context.
+ *
+ * The dependencies on the previous accesses to the resources are added
+ * to the explicit ones and the accesses of the request are recorded in
+ * the same critical section, so concurrent submissions touching the same
+ * BOs are ordered the way they are recorded.
+ *
+ * \return  0 on success otherwise POSIX Error code
+ */
+drm_private int amdgpu_cs_implicit_sync_submit(amdgpu_context_handle context,
+					       struct amdgpu_cs_request *ibs_request)
+{
+	amdgpu_device_handle dev = context->dev;
+	struct amdgpu_bo_list *list = ibs_request->resources;
+	struct amdgpu_cs_request request = *ibs_request;
+	struct amdgpu_bo_sync_fence submitted;
+	struct amdgpu_cs_fence *fences;
+	uint32_t i, j, max_deps, num_deps = 0;
+	int r;
+
+	pthread_mutex_lock(&dev->implicit_sync_mutex);
+
+	if (!LIST_IS_EMPTY(&dev->implicit_sync_zombies))
+		amdgpu_cs_implicit_sync_reap(dev);
+
+	max_deps = ibs_request->number_of_dependencies;
+	for (i = 0; i < list->number_of_resources; i++)
+		max_deps += 1 + list->resources[i]->sync.num_reads;
+
+	fences = malloc(sizeof(struct amdgpu_cs_fence) * max_deps);
+	if (!fences) {
+		r = ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < ibs_request->number_of_dependencies; i++)
+		num_deps = amdgpu_cs_add_dependency(context,
+				ibs_request->ip_type, ibs_request->ip_instance,
+				ibs_request->ring, fences, num_deps,
+				&ibs_request->dependencies[i]);
+
+	for (i = 0; i < list->number_of_resources; i++) {
+		struct amdgpu_bo_sync *sync = &list->resources[i]->sync;
+
+		if (amdgpu_cs_implicit_sync_live(dev, &sync->write))
+			num_deps = amdgpu_cs_add_dependency(context,
+					ibs_request->ip_type,
+					ibs_request->ip_instance,
+					ibs_request->ring, fences, num_deps,
+					&sync->write.fence);
+
+		if (!(list->usage[i] & AMDGPU_BO_USAGE_WRITE))
+			continue;
+
+		for (j = 0; j < sync->num_reads; j++) {
+			if (!amdgpu_cs_implicit_sync_live(dev, &sync->reads[j]))
+				continue;
+			num_deps = amdgpu_cs_add_dependency(context,
+					ibs_request->ip_type,
+					ibs_request->ip_instance,
+					ibs_request->ring, fences, num_deps,
+					&sync->reads[j].fence);
+		}
+	}
+
+	request.number_of_dependencies = num_deps;
+	request.dependencies = fences;
+	r = amdgpu_cs_submit_request(context, &request);
+	free(fences);
+	if (r)
+		goto out;
+
+	ibs_request->seq_no = request.seq_no;
+
+	submitted.fence.context = context;
+	submitted.fence.ip_type = ibs_request->ip_type;
+	submitted.fence.ip_instance = ibs_request->ip_instance;
+	submitted.fence.ring = ibs_request->ring;
+	submitted.fence.fence = request.seq_no;
+	submitted.serial = context->implicit_sync_serial;
+
+	for (i = 0; i < list->number_of_resources; i++) {
+		struct amdgpu_bo *bo = list->resources[i];
+
+		if (list->usage[i] & AMDGPU_BO_USAGE_WRITE) {
+			bo->sync.write = submitted;
+			bo->sync.num_reads = 0;
+		} else if (list->usage[i] & AMDGPU_BO_USAGE_READ) {
+			amdgpu_cs_implicit_sync_read(bo, &submitted);
+		}
+	}
+
+out:
+	pthread_mutex_unlock(&dev->implicit_sync_mutex);
+	return r;
+}
+
+/**
+ * Stop tracking the submissions of a context that is being freed.
+ *
+ * \return  true if submissions are still running, the context is then
+ *	    kept as a zombie and destroyed once they completed. The queue
+ *	    of an asynchronous zombie keeps submitting and translating its
+ *	    sequence numbers until then.
+ */
+drm_private bool amdgpu_cs_implicit_sync_retire(amdgpu_context_handle context)
+{
+	amdgpu_device_handle dev = context->dev;
+	bool running;
+
+	pthread_mutex_lock(&dev->implicit_sync_mutex);
+	if (!LIST_IS_EMPTY(&dev->implicit_sync_zombies))
+		amdgpu_cs_implicit_sync_reap(dev);
+
+	context->implicit_sync = false;
+	running = !amdgpu_cs_implicit_sync_ctx_idle(context);
+	if (running)
+		list_add(&context->implicit_sync_link, &dev->implicit_sync_zombies);
+	else
+		context->implicit_sync_serial = 0;
+	pthread_mutex_unlock(&dev->implicit_sync_mutex);
+
+	return running;
+}
+
+drm_public int amdgpu_cs_ctx_set_implicit_sync(amdgpu_context_handle context,
+					       bool enable)
+{
+	amdgpu_device_handle dev;
+
+	if (!context)
+		return EINVAL;
+
+	dev = context->dev;
+	pthread_mutex_lock(&dev->implicit_sync_mutex);
+	/* the fences recorded so far stay valid while the context lives */
+	if (enable && !context->implicit_sync_serial) {
+		context->implicit_sync_serial =
+			atomic_add64((int64 *)&implicit_sync_serial, 1) + 1;
+		context->implicit_sync_pinned = true;
+	}
+	context->implicit_sync = enable;
+	pthread_mutex_unlock(&dev->implicit_sync_mutex);
+
+	return 0;
+}
@@ -0,0 +1,669 @@
+/**
+ * \file amdgpu_cs_queue.c
+ *
+ *  Asynchronous command submission. amdgpu_cs_submit() assigns sequence
+ *  numbers and queues requests, a worker thread per context hands them
+ *  to the accelerant.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#if HAVE_ALLOCA_H
+# include <alloca.h>
+#endif
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+
+static int amdgpu_cs_queue_grow(void **array, uint32_t *size,
+				uint32_t count, size_t elem_size)
+{
+	void *new_array;
+
+	if (count <= *size)
+		return 0;
+
+	new_array = realloc(*array, count * elem_size);
+	if (!new_array)
+		return ENOMEM;
+
+	*array = new_array;
+	*size = count;
+	return 0;
+}
+
+static struct amdgpu_cs_seq_map *
+amdgpu_cs_queue_get_seq_map(amdgpu_context_handle context,
+			    struct amdgpu_cs_request *ibs_request)
+{
+	struct amdgpu_cs_seq_map **seq_map;
+
+	seq_map = &context->rings[ibs_request->ip_type][ibs_request->ip_instance][ibs_request->ring]->seq_map;
+	if (!*seq_map)
+		*seq_map = calloc(1, sizeof(struct amdgpu_cs_seq_map));
+
+	return *seq_map;
+}
+
+/**
+ * Check whether \c next can be appended to the submission started by
+ * \c batch. Requests with dependencies always start a new submission,
+ * so a merged submission never has to wait for one of its own parts.
+ */
+static bool amdgpu_cs_queue_can_merge(struct amdgpu_cs_queued_request *batch,
+				      uint32_t number_of_ibs,
+				      uint32_t max_ibs,
+				      struct amdgpu_cs_queued_request *next)
+{
+	return next->seq_map == batch->seq_map &&
+	       next->bo_list_handle == batch->bo_list_handle &&
+	       next->fence_info.handle == batch->fence_info.handle &&
+	       next->fence_info.offset == batch->fence_info.offset &&
+	       next->number_of_dependencies == 0 &&
+	       number_of_ibs + next->number_of_ibs <= max_ibs;
+}
+
+/**
+ * Wait up to the coalescing window, counted from when \c batch was
+ * queued, for more requests to arrive.
+ *
+ * \return  true if requests were queued after \c head, false if the
+ *	    batch should be submitted now
+ */
+static bool amdgpu_cs_queue_linger(struct amdgpu_cs_queue *queue,
+				   struct amdgpu_cs_queued_request *batch,
+				   uint32_t head)
+{
+	uint64_t window, deadline;
+	struct timespec ts;
+	bool more;
+
+	window = (uint64_t)(uint32_t)atomic_get(&queue->coalesce_window_us) * 1000ull;
+	if (!window || atomic_get(&queue->flush) || atomic_get(&queue->quit))
+		return false;
+
+	deadline = batch->queued_ns + window;
+	ts.tv_sec = deadline / 1000000000ull;
+	ts.tv_nsec = deadline % 1000000000ull;
+
+	pthread_mutex_lock(&queue->mutex);
+	atomic_set(&queue->worker_idle, 1);
+	while (atomic_get(&queue->head) == (int32)head &&
+	       !atomic_get(&queue->flush) && !atomic_get(&queue->quit)) {
+		if (pthread_cond_timedwait(&queue->work_cond, &queue->mutex,
+					   &ts) == ETIMEDOUT)
+			break;
+	}
+	atomic_set(&queue->worker_idle, 0);
+	more = atomic_get(&queue->head) != (int32)head;
+	pthread_mutex_unlock(&queue->mutex);
+
+	return more;
+}
+
+static unsigned amdgpu_cs_priority_class(int32 priority)
+{
+	if (priority == AMDGPU_CTX_PRIORITY_UNSET)
+		return 2;
+	if (priority < AMDGPU_CTX_PRIORITY_LOW)
+		return 0;
+	if (priority < AMDGPU_CTX_PRIORITY_NORMAL)
+		return 1;
+	if (priority < AMDGPU_CTX_PRIORITY_HIGH)
+		return 2;
+	if (priority < AMDGPU_CTX_PRIORITY_VERY_HIGH)
+		return 3;
+	return 4;
+}
+
+static bool amdgpu_cs_queue_higher_queued(amdgpu_device_handle dev,
+					  unsigned priority_class)
+{
+	unsigned i;
+
+	for (i = priority_class + 1; i < AMDGPU_CS_PRIORITY_CLASSES; i++)
+		if (atomic_get(&dev->cs_queued[i]))
+			return true;
+
+	return false;
+}
+
+/**
+ * Hold back while asynchronous contexts of higher priority have requests
+ * queued, at most AMDGPU_CS_PRIORITY_YIELD_NS so that this context can't
+ * starve, and not at all once somebody waits for this queue.
+ */
+static void amdgpu_cs_queue_yield(amdgpu_context_handle context)
+{
+	amdgpu_device_handle dev = context->dev;
+	struct amdgpu_cs_queue *queue = context->queue;
+	unsigned priority_class;
+	uint64_t deadline;
+	struct timespec ts;
+
+	priority_class = amdgpu_cs_priority_class(atomic_get(&context->priority));
+	if (!amdgpu_cs_queue_higher_queued(dev, priority_class))
+		return;
+
+	deadline = amdgpu_cs_calculate_timeout(AMDGPU_CS_PRIORITY_YIELD_NS);
+	ts.tv_sec = deadline / 1000000000ull;
+	ts.tv_nsec = deadline % 1000000000ull;
+
+	pthread_mutex_lock(&dev->cs_sched_mutex);
+	atomic_add(&dev->cs_sched_waiters, 1);
+	atomic_set(&queue->yielding, 1);
+	while (amdgpu_cs_queue_higher_queued(dev, priority_class) &&
+	       !atomic_get(&queue->flush) && !atomic_get(&queue->quit)) {
+		if (pthread_cond_timedwait(&dev->cs_sched_cond,
+					   &dev->cs_sched_mutex, &ts) == ETIMEDOUT)
+			break;
+	}
+	atomic_set(&queue->yielding, 0);
+	atomic_add(&dev->cs_sched_waiters, -1);
+	pthread_mutex_unlock(&dev->cs_sched_mutex);
+}
+
+/**
+ * Make the worker submit its next batch without holding it back for
+ * coalescing or for contexts of higher priority.
+ *
+ * Must be called with the queue mutex held.
+ */
+static void amdgpu_cs_queue_flush_locked(amdgpu_context_handle context)
+{
+	amdgpu_device_handle dev = context->dev;
+	struct amdgpu_cs_queue *queue = context->queue;
+
+	atomic_set(&queue->flush, 1);
+	pthread_cond_signal(&queue->work_cond);
+
+	if (atomic_get(&queue->yielding)) {
+		pthread_mutex_lock(&dev->cs_sched_mutex);
+		pthread_cond_broadcast(&dev->cs_sched_cond);
+		pthread_mutex_unlock(&dev->cs_sched_mutex);
+	}
+}
+
+static void amdgpu_cs_queue_flush(amdgpu_context_handle context)
+{
+	struct amdgpu_cs_queue *queue = context->queue;
+
+	if (!atomic_get(&queue->coalesce_window_us) &&
+	    !atomic_get(&queue->yielding))
+		return;
+
+	pthread_mutex_lock(&queue->mutex);
+	amdgpu_cs_queue_flush_locked(context);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+/**
+ * Account for \c count requests handed to the accelerant and wake workers
+ * holding back for them.
+ */
+static void amdgpu_cs_queue_dequeued(amdgpu_context_handle context,
+				     uint32_t first, uint32_t count)
+{
+	amdgpu_device_handle dev = context->dev;
+	struct amdgpu_cs_queue *queue = context->queue;
+	bool drained = false;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		unsigned priority_class =
+			queue->requests[(first + i) % AMDGPU_CS_QUEUE_SIZE].priority_class;
+
+		if (atomic_add(&dev->cs_queued[priority_class], -1) == 1)
+			drained = true;
+	}
+
+	if (drained && atomic_get(&dev->cs_sched_waiters)) {
+		pthread_mutex_lock(&dev->cs_sched_mutex);
+		pthread_cond_broadcast(&dev->cs_sched_cond);
+		pthread_mutex_unlock(&dev->cs_sched_mutex);
+	}
+}
+
+/**
+ * Hand \c count consecutive queued requests to the accelerant as a single
+ * submission and publish the resulting kernel sequence number.
+ */
+static void amdgpu_cs_queue_run_batch(amdgpu_context_handle context,
+				      uint32_t first, uint32_t count)
+{
+	struct amdgpu_cs_queue *queue = context->queue;
+	struct amdgpu_cs_queued_request *request, *last;
+	struct amdgpu_cs_seq_map *seq_map;
+	struct drm_amdgpu_cs_chunk_dep *dependencies = NULL;
+	struct amdgpu_cs_ib_info *ibs;
+	uint32_t i, number_of_ibs, num_deps = 0;
+	uint64_t seq_no = AMDGPU_NULL_SUBMIT_SEQ;
+	int r = 0;
+
+	request = &queue->requests[first % AMDGPU_CS_QUEUE_SIZE];
+	last = &queue->requests[(first + count - 1) % AMDGPU_CS_QUEUE_SIZE];
+	seq_map = request->seq_map;
+
+	ibs = request->ibs;
+	number_of_ibs = request->number_of_ibs;
+	if (count > 1) {
+		for (i = 1; i < count; i++)
+			number_of_ibs += queue->requests[(first + i) % AMDGPU_CS_QUEUE_SIZE].number_of_ibs;
+
+		ibs = alloca(sizeof(struct amdgpu_cs_ib_info) * number_of_ibs);
+		number_of_ibs = 0;
+		for (i = 0; i < count; i++) {
+			struct amdgpu_cs_queued_request *part;
+
+			part = &queue->requests[(first + i) % AMDGPU_CS_QUEUE_SIZE];
+			memcpy(&ibs[number_of_ibs], part->ibs,
+			       sizeof(struct amdgpu_cs_ib_info) * part->number_of_ibs);
+			number_of_ibs += part->number_of_ibs;
+		}
+	}
+
+	if (request->number_of_dependencies) {
+		dependencies = alloca(sizeof(struct drm_amdgpu_cs_chunk_dep) *
+				      request->number_of_dependencies);
+
+		for (i = 0; i < request->number_of_dependencies; i++) {
+			struct drm_amdgpu_cs_chunk_dep *dep = &dependencies[num_deps];
+
+			/* blocks until dependencies from other queues are
+			 * submitted, they were queued before this request */
+			r = amdgpu_cs_fence_to_dep(&request->dependencies[i],
+						   AMDGPU_TIMEOUT_INFINITE, dep);
+			if (r)
+				break;
+			if (dep->handle != AMDGPU_NULL_SUBMIT_SEQ)
+				num_deps++;
+		}
+	}
+
+	if (!r)
+		r = amdgpu_cs_emit(context, request->ip_type,
+				   request->ip_instance, request->ring,
+				   request->bo_list_handle, number_of_ibs, ibs,
+				   &request->fence_info, num_deps, dependencies,
+				   &seq_no);
+	if (r) {
+		atomic_test_and_set(&queue->error, r, 0);
+		seq_no = AMDGPU_NULL_SUBMIT_SEQ;
+	} else {
+		if (request->fence_info.handle)
+			amdgpu_cs_record_user_fence(context, request->ip_type,
+						    request->ip_instance,
+						    request->ring,
+						    &request->fence_info, seq_no);
+		atomic_set64((int64 *)&seq_map->last_kernel_seq, seq_no);
+	}
+
+	atomic_set64((int64 *)&seq_map->writing, last->seq_no);
+	for (i = 0; i < count; i++) {
+		uint64_t seq = queue->requests[(first + i) % AMDGPU_CS_QUEUE_SIZE].seq_no;
+
+		atomic_set64((int64 *)&seq_map->kernel_seq[seq % AMDGPU_CS_SEQ_WINDOW],
+			     seq_no);
+	}
+	atomic_set64((int64 *)&seq_map->submitted, last->seq_no);
+}
+
+static void *amdgpu_cs_queue_worker(void *data)
+{
+	amdgpu_context_handle context = data;
+	struct amdgpu_cs_queue *queue = context->queue;
+	uint32_t head, tail, count, number_of_ibs, max_ibs;
+	struct amdgpu_cs_queued_request *batch, *next;
+
+	tail = atomic_get(&queue->tail);
+	for (;;) {
+		head = atomic_get(&queue->head);
+		if (head == tail) {
+			if (atomic_get(&queue->quit))
+				break;
+
+			pthread_mutex_lock(&queue->mutex);
+			atomic_set(&queue->worker_idle, 1);
+			while (atomic_get(&queue->head) == (int32)tail &&
+			       !atomic_get(&queue->quit))
+				pthread_cond_wait(&queue->work_cond, &queue->mutex);
+			atomic_set(&queue->worker_idle, 0);
+			pthread_mutex_unlock(&queue->mutex);
+			continue;
+		}
+
+		/* coalesce everything compatible that is already queued */
+		batch = &queue->requests[tail % AMDGPU_CS_QUEUE_SIZE];
+		max_ibs = atomic_get(&queue->coalesce_ibs);
+		number_of_ibs = batch->number_of_ibs;
+		for (count = 1; tail + count != head; count++) {
+			next = &queue->requests[(tail + count) % AMDGPU_CS_QUEUE_SIZE];
+			if (!amdgpu_cs_queue_can_merge(batch, number_of_ibs,
+						       max_ibs, next))
+				break;
+			number_of_ibs += next->number_of_ibs;
+		}
+
+		/* the batch could still grow, give the next request some time */
+		if (tail + count == head && number_of_ibs < max_ibs &&
+		    amdgpu_cs_queue_linger(queue, batch, head))
+			continue;
+
+		amdgpu_cs_queue_yield(context);
+
+		/* waiters for later batches ask again after this one */
+		atomic_set(&queue->flush, 0);
+		amdgpu_cs_queue_run_batch(context, tail, count);
+		amdgpu_cs_queue_dequeued(context, tail, count);
+		tail += count;
+
+		pthread_mutex_lock(&queue->mutex);
+		atomic_set(&queue->tail, tail);
+		pthread_cond_broadcast(&queue->done_cond);
+		pthread_mutex_unlock(&queue->mutex);
+	}
+
+	return NULL;
+}
+
+drm_private void amdgpu_cs_sched_init(amdgpu_device_handle dev)
+{
+	pthread_condattr_t attr;
+
+	pthread_mutex_init(&dev->cs_sched_mutex, NULL);
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&dev->cs_sched_cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+drm_private void amdgpu_cs_sched_fini(amdgpu_device_handle dev)
+{
+	pthread_cond_destroy(&dev->cs_sched_cond);
+	pthread_mutex_destroy(&dev->cs_sched_mutex);
+}
+
+/**
+ * Switch a context to asynchronous submission and start its worker.
+ *
+ * Must be called with sequence_mutex held.
+ */
+drm_private int amdgpu_cs_queue_create(amdgpu_context_handle context)
+{
+	struct amdgpu_cs_queue *queue;
+	pthread_condattr_t attr;
+	int r;
+
+	queue = calloc(1, sizeof(struct amdgpu_cs_queue));
+	if (!queue)
+		return ENOMEM;
+
+	pthread_mutex_init(&queue->mutex, NULL);
+	atomic_set(&queue->coalesce_ibs, AMDGPU_CS_MAX_IBS_PER_SUBMIT);
+
+	/* waits use the same clock as fence timeouts */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&queue->work_cond, &attr);
+	pthread_cond_init(&queue->done_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	context->queue = queue;
+	r = pthread_create(&queue->thread, NULL, amdgpu_cs_queue_worker, context);
+	if (r) {
+		context->queue = NULL;
+		pthread_cond_destroy(&queue->done_cond);
+		pthread_cond_destroy(&queue->work_cond);
+		pthread_mutex_destroy(&queue->mutex);
+		free(queue);
+		return r;
+	}
+
+	return 0;
+}
+
+/**
+ * Let the worker wait up to \c window_us for compatible requests to merge
+ * into a submission of at most \c max_ibs IBs.
+ *
+ * Must be called with sequence_mutex held.
+ */
+drm_private void amdgpu_cs_queue_set_coalescing(amdgpu_context_handle context,
+						uint32_t window_us,
+						uint32_t max_ibs)
+{
+	struct amdgpu_cs_queue *queue = context->queue;
+
+	if (!max_ibs || max_ibs > AMDGPU_CS_MAX_IBS_PER_SUBMIT)
+		max_ibs = AMDGPU_CS_MAX_IBS_PER_SUBMIT;
+
+	atomic_set(&queue->coalesce_ibs, max_ibs);
+	atomic_set(&queue->coalesce_window_us, window_us);
+
+	/* don't keep holding back requests under the old window */
+	pthread_mutex_lock(&queue->mutex);
+	amdgpu_cs_queue_flush_locked(context);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+/**
+ * Submit everything still queued, stop the worker and switch the context
+ * back to synchronous submission.
+ */
+drm_private void amdgpu_cs_queue_destroy(amdgpu_context_handle context)
+{
+	struct amdgpu_cs_queue *queue = context->queue;
+	struct amdgpu_cs_ring *ring;
+	int i;
+
+	pthread_mutex_lock(&queue->mutex);
+	atomic_set(&queue->quit, 1);
+	pthread_cond_signal(&queue->work_cond);
+	pthread_mutex_unlock(&queue->mutex);
+	pthread_join(queue->thread, NULL);
+
+	for (i = 0; i < AMDGPU_CS_QUEUE_SIZE; i++) {
+		free(queue->requests[i].ibs);
+		free(queue->requests[i].dependencies);
+	}
+
+	for (ring = context->ring_list; ring; ring = ring->next) {
+		free(ring->seq_map);
+		ring->seq_map = NULL;
+	}
+
+	pthread_cond_destroy(&queue->done_cond);
+	pthread_cond_destroy(&queue->work_cond);
+	pthread_mutex_destroy(&queue->mutex);
+	free(queue);
+	context->queue = NULL;
+}
+
+/**
+ * Queue a validated, non-empty request of an asynchronous context.
+ *
+ * Only blocks when AMDGPU_CS_QUEUE_SIZE requests are already waiting for
+ * the worker.
+ */
+drm_private int amdgpu_cs_queue_submit(amdgpu_context_handle context,
+				       struct amdgpu_cs_request *ibs_request)
+{
+	struct amdgpu_cs_queue *queue = context->queue;
+	struct amdgpu_cs_queued_request *request;
+	struct amdgpu_cs_seq_map *seq_map;
+	struct amdgpu_cs_ring *ring;
+	uint32_t i, head, num_deps;
+	int r;
+
+	/* report submissions the worker failed to pass on */
+	r = atomic_get_and_set(&queue->error, 0);
+	if (r)
+		return r;
+
+	pthread_mutex_lock(&context->sequence_mutex);
+
+	head = atomic_get(&queue->head);
+	if (head - (uint32_t)atomic_get(&queue->tail) == AMDGPU_CS_QUEUE_SIZE) {
+		pthread_mutex_lock(&queue->mutex);
+		while (head - (uint32_t)atomic_get(&queue->tail) == AMDGPU_CS_QUEUE_SIZE)
+			pthread_cond_wait(&queue->done_cond, &queue->mutex);
+		pthread_mutex_unlock(&queue->mutex);
+	}
+	request = &queue->requests[head % AMDGPU_CS_QUEUE_SIZE];
+
+	ring = amdgpu_cs_create_ring(context, ibs_request->ip_type,
+				     ibs_request->ip_instance, ibs_request->ring);
+	if (!ring) {
+		r = ENOMEM;
+		goto out;
+	}
+	num_deps = ibs_request->number_of_dependencies + ring->sem_deps.count;
+
+	seq_map = amdgpu_cs_queue_get_seq_map(context, ibs_request);
+	if (!seq_map) {
+		r = ENOMEM;
+		goto out;
+	}
+	r = amdgpu_cs_queue_grow((void **)&request->ibs, &request->max_ibs,
+				 ibs_request->number_of_ibs,
+				 sizeof(struct amdgpu_cs_ib_info));
+	if (r)
+		goto out;
+	r = amdgpu_cs_queue_grow((void **)&request->dependencies,
+				 &request->max_dependencies, num_deps,
+				 sizeof(struct amdgpu_cs_fence));
+	if (r)
+		goto out;
+
+	request->seq_map = seq_map;
+	request->ip_type = ibs_request->ip_type;
+	request->ip_instance = ibs_request->ip_instance;
+	request->ring = ibs_request->ring;
+	request->bo_list_handle = ibs_request->resources ?
+		ibs_request->resources->handle : 0;
+	request->fence_info = ibs_request->fence_info;
+	request->number_of_ibs = ibs_request->number_of_ibs;
+	memcpy(request->ibs, ibs_request->ibs,
+	       sizeof(struct amdgpu_cs_ib_info) * ibs_request->number_of_ibs);
+
+	num_deps = 0;
+	for (i = 0; i < ibs_request->number_of_dependencies; i++)
+		num_deps = amdgpu_cs_add_dependency(context, ibs_request->ip_type,
+						    ibs_request->ip_instance,
+						    ibs_request->ring,
+						    request->dependencies, num_deps,
+						    &ibs_request->dependencies[i]);
+	for (i = 0; i < ring->sem_deps.count; i++)
+		num_deps = amdgpu_cs_add_dependency(context, ibs_request->ip_type,
+						    ibs_request->ip_instance,
+						    ibs_request->ring,
+						    request->dependencies, num_deps,
+						    &ring->sem_deps.fences[i]);
+	ring->sem_deps.count = 0;
+	request->number_of_dependencies = num_deps;
+
+	request->seq_no = ++ring->last_seq;
+	ibs_request->seq_no = request->seq_no;
+	if (atomic_get(&queue->coalesce_window_us))
+		request->queued_ns = amdgpu_cs_current_time();
+	request->priority_class = amdgpu_cs_priority_class(atomic_get(&context->priority));
+	atomic_add(&context->dev->cs_queued[request->priority_class], 1);
+
+	atomic_set(&queue->head, head + 1);
+
+out:
+	pthread_mutex_unlock(&context->sequence_mutex);
+
+	if (!r && atomic_get(&queue->worker_idle)) {
+		pthread_mutex_lock(&queue->mutex);
+		pthread_cond_signal(&queue->work_cond);
+		pthread_mutex_unlock(&queue->mutex);
+	}
+
+	return r;
+}
+
+/**
+ * Translate a sequence number of an asynchronous context to the one the
+ * kernel driver assigned, waiting for the worker to submit it if needed.
+ *
+ * Sequence numbers older than the translation window map to the last
+ * successful submission of the ring. It completes after them, so waiting
+ * for it stays correct, and a failed submission in the window can't make
+ * them look signaled.
+ *
+ * \param   fence       - \c [in]  Fence of an asynchronous context
+ * \param   abs_timeout - \c [in]  Absolute timeout for the worker, 0 to not wait
+ * \param   seq_no      - \c [out] Kernel sequence number, AMDGPU_NULL_SUBMIT_SEQ
+ *				   if the submission failed
+ *
+ * \return  0 on success, ETIME if the request is still queued, otherwise
+ *	    POSIX Error code
+ */
+drm_private int amdgpu_cs_queue_translate(struct amdgpu_cs_fence *fence,
+					  uint64_t abs_timeout,
+					  uint64_t *seq_no)
+{
+	amdgpu_context_handle context = fence->context;
+	struct amdgpu_cs_queue *queue = context->queue;
+	struct amdgpu_cs_ring *ring;
+	struct amdgpu_cs_seq_map *seq_map;
+	uint64_t seq = fence->fence, submitted;
+	struct timespec ts;
+	int r = 0;
+
+	ring = amdgpu_cs_get_ring(context, fence->ip_type, fence->ip_instance,
+				  fence->ring);
+	seq_map = ring ? ring->seq_map : NULL;
+	if (!seq_map)
+		return EINVAL;
+
+	submitted = atomic_get64((int64 *)&seq_map->submitted);
+	if (submitted < seq) {
+		/* somebody is interested in the fence, stop holding it back */
+		amdgpu_cs_queue_flush(context);
+		if (!abs_timeout)
+			return ETIME;
+
+		ts.tv_sec = abs_timeout / 1000000000ull;
+		ts.tv_nsec = abs_timeout % 1000000000ull;
+
+		pthread_mutex_lock(&queue->mutex);
+		while ((submitted = atomic_get64((int64 *)&seq_map->submitted)) < seq) {
+			/* the request may be in the batch after the current one */
+			amdgpu_cs_queue_flush_locked(context);
+			if (abs_timeout == AMDGPU_TIMEOUT_INFINITE) {
+				pthread_cond_wait(&queue->done_cond, &queue->mutex);
+			} else if (pthread_cond_timedwait(&queue->done_cond,
+							  &queue->mutex, &ts) == ETIMEDOUT) {
+				r = ETIME;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&queue->mutex);
+		if (r)
+			return r;
+	}
+
+	for (;;) {
+		if (seq + AMDGPU_CS_SEQ_WINDOW <= submitted) {
+			/* written before submitted, so it is at least as new */
+			*seq_no = atomic_get64((int64 *)&seq_map->last_kernel_seq);
+			return 0;
+		}
+
+		*seq_no = atomic_get64((int64 *)&seq_map->kernel_seq[seq % AMDGPU_CS_SEQ_WINDOW]);
+
+		/* done unless the worker reused the slot meanwhile */
+		if (seq + AMDGPU_CS_SEQ_WINDOW > (uint64_t)atomic_get64((int64 *)&seq_map->writing))
+			return 0;
+
+		submitted = atomic_get64((int64 *)&seq_map->submitted);
+	}
+}
@@ -0,0 +1,193 @@
+/**
+ * \file amdgpu_cs_stats.c
+ *
+ *  Command submission statistics. Counters are per device and ring and
+ *  are updated with atomic adds, so submitting threads never serialize on
+ *  them.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct amdgpu_cs_ring_stats *
+amdgpu_cs_stats_ring(amdgpu_device_handle dev, unsigned ip_type,
+		     unsigned ip_instance, uint32_t ring)
+{
+	if (ip_type >= AMDGPU_HW_IP_NUM ||
+	    ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT ||
+	    ring >= AMDGPU_CS_MAX_RINGS)
+		return NULL;
+
+	return &dev->cs_stats->rings[ip_type][ip_instance][ring];
+}
+
+static void amdgpu_cs_stats_add(uint64_t *counter, uint64_t value)
+{
+	atomic_add64((int64 *)counter, value);
+}
+
+static void amdgpu_cs_stats_latency(uint64_t *histogram, uint64_t start)
+{
+	uint64_t us = (amdgpu_cs_current_time() - start) / 1000;
+	unsigned bucket = 0;
+
+	while (us && bucket < AMDGPU_CS_STATS_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+
+	amdgpu_cs_stats_add(&histogram[bucket], 1);
+}
+
+/**
+ * Start timing an operation.
+ *
+ * \return  Start time to pass to the amdgpu_cs_stats_* functions, 0 if
+ *	    collection is disabled
+ */
+drm_private uint64_t amdgpu_cs_stats_start(amdgpu_device_handle dev)
+{
+	if (!atomic_get(&dev->cs_stats_enabled))
+		return 0;
+
+	return amdgpu_cs_current_time();
+}
+
+drm_private void amdgpu_cs_stats_request(amdgpu_device_handle dev,
+					 unsigned ip_type, unsigned ip_instance,
+					 uint32_t ring, uint64_t start)
+{
+	struct amdgpu_cs_ring_stats *stats;
+
+	if (!start)
+		return;
+
+	stats = amdgpu_cs_stats_ring(dev, ip_type, ip_instance, ring);
+	if (!stats)
+		return;
+
+	amdgpu_cs_stats_add(&stats->requests, 1);
+	amdgpu_cs_stats_latency(stats->request_latency, start);
+}
+
+drm_private void amdgpu_cs_stats_submission(amdgpu_device_handle dev,
+					    unsigned ip_type,
+					    unsigned ip_instance,
+					    uint32_t ring, uint64_t start,
+					    uint32_t number_of_ibs,
+					    struct amdgpu_cs_ib_info *ibs,
+					    uint32_t number_of_dependencies)
+{
+	struct amdgpu_cs_ring_stats *stats;
+	uint64_t ib_bytes = 0;
+	uint32_t i;
+
+	if (!start)
+		return;
+
+	stats = amdgpu_cs_stats_ring(dev, ip_type, ip_instance, ring);
+	if (!stats)
+		return;
+
+	for (i = 0; i < number_of_ibs; i++)
+		ib_bytes += ibs[i].size * 4;
+
+	amdgpu_cs_stats_add(&stats->submissions, 1);
+	amdgpu_cs_stats_add(&stats->ibs, number_of_ibs);
+	amdgpu_cs_stats_add(&stats->ib_bytes, ib_bytes);
+	amdgpu_cs_stats_add(&stats->dependencies, number_of_dependencies);
+	amdgpu_cs_stats_latency(stats->submit_latency, start);
+}
+
+drm_private void amdgpu_cs_stats_wait(amdgpu_device_handle dev,
+				      unsigned ip_type, unsigned ip_instance,
+				      uint32_t ring, uint64_t start)
+{
+	struct amdgpu_cs_ring_stats *stats;
+
+	if (!start)
+		return;
+
+	stats = amdgpu_cs_stats_ring(dev, ip_type, ip_instance, ring);
+	if (!stats)
+		return;
+
+	amdgpu_cs_stats_add(&stats->waits, 1);
+	amdgpu_cs_stats_latency(stats->wait_latency, start);
+}
+
+drm_private void amdgpu_cs_stats_fini(amdgpu_device_handle dev)
+{
+	free(dev->cs_stats);
+}
+
+drm_public int amdgpu_cs_set_stats_enabled(amdgpu_device_handle dev,
+					   bool enable)
+{
+	if (!dev)
+		return EINVAL;
+
+	if (!enable) {
+		atomic_set(&dev->cs_stats_enabled, 0);
+		return 0;
+	}
+
+	pthread_mutex_lock(&stats_mutex);
+	if (!dev->cs_stats) {
+		dev->cs_stats = calloc(1, sizeof(struct amdgpu_cs_stats));
+		if (!dev->cs_stats) {
+			pthread_mutex_unlock(&stats_mutex);
+			return ENOMEM;
+		}
+	}
+	/* atomic_set() orders the allocation before the flag */
+	atomic_set(&dev->cs_stats_enabled, 1);
+	pthread_mutex_unlock(&stats_mutex);
+
+	return 0;
+}
+
+drm_public int amdgpu_cs_query_stats(amdgpu_device_handle dev,
+				     unsigned ip_type, unsigned ip_instance,
+				     uint32_t ring,
+				     struct amdgpu_cs_ring_stats *stats)
+{
+	struct amdgpu_cs_ring_stats *ring_stats;
+	uint64_t *dst, *src;
+	unsigned i;
+
+	if (!dev || !stats)
+		return EINVAL;
+	if (ip_type >= AMDGPU_HW_IP_NUM)
+		return EINVAL;
+	if (ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT)
+		return EINVAL;
+	if (ring >= AMDGPU_CS_MAX_RINGS)
+		return EINVAL;
+
+	pthread_mutex_lock(&stats_mutex);
+	if (!dev->cs_stats) {
+		pthread_mutex_unlock(&stats_mutex);
+		memset(stats, 0, sizeof(*stats));
+		return 0;
+	}
+	ring_stats = amdgpu_cs_stats_ring(dev, ip_type, ip_instance, ring);
+	pthread_mutex_unlock(&stats_mutex);
+
+	/* every counter is read atomically, not the whole set at once */
+	dst = (uint64_t *)stats;
+	src = (uint64_t *)ring_stats;
+	for (i = 0; i < sizeof(*stats) / sizeof(uint64_t); i++)
+		dst[i] = atomic_get64((int64 *)&src[i]);
+
+	return 0;
+}
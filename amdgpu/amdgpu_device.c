@@ -35,6 +35,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sched.h>
 
 #include "xf86drm.h"
 #include "amdgpu_drm.h"
@@ -43,32 +44,162 @@
 
 #define PTR_TO_UINT(x) ((unsigned)((intptr_t)(x)))
 
-static pthread_mutex_t dev_mutex = PTHREAD_MUTEX_INITIALIZER;
-static amdgpu_device_handle dev_list;
+#define AMDGPU_DEVICE_BUCKETS 16
 
-static void amdgpu_device_free_internal(amdgpu_device_handle dev)
+/**
+ * Devices by accelerant. Lookups don't lock, they announce themselves in
+ * the reader count of the current phase instead. Devices are unlinked
+ * under the mutex and freed once the readers that may still see them are
+ * gone.
+ */
+static struct {
+	pthread_mutex_t mutex;
+	atomic_t phase;
+	atomic_t readers[2];
+	/** Published devices, the pools of amdgpu_cs.c are freed at 0 */
+	unsigned count;
+	amdgpu_device_handle buckets[AMDGPU_DEVICE_BUCKETS];
+} dev_registry = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static unsigned amdgpu_device_hash(struct accelerant_base *acc)
 {
-	amdgpu_device_handle *node = &dev_list;
+	uintptr_t key = (uintptr_t)acc;
 
-	pthread_mutex_lock(&dev_mutex);
-	while (*node != dev && (*node)->next)
-		node = &(*node)->next;
-	*node = (*node)->next;
-	pthread_mutex_unlock(&dev_mutex);
+	/* accelerants are heap objects, the low bits are alignment */
+	key ^= key >> 16;
+	return (key >> 4) % AMDGPU_DEVICE_BUCKETS;
+}
+
+/**
+ * Take a reference unless the device is already being freed.
+ */
+static bool amdgpu_device_get_unless_zero(amdgpu_device_handle dev)
+{
+	int32 refcount = atomic_get(&dev->refcount);
+
+	while (refcount > 0) {
+		int32 old = atomic_test_and_set(&dev->refcount, refcount + 1,
+						refcount);
+		if (old == refcount)
+			return true;
+		refcount = old;
+	}
+
+	return false;
+}
+
+/**
+ * Find the device of \c acc and take a reference to it, without locking.
+ */
+static amdgpu_device_handle amdgpu_device_lookup(struct accelerant_base *acc)
+{
+	int32 phase = atomic_get(&dev_registry.phase) & 1;
+	amdgpu_device_handle dev;
+
+	atomic_add(&dev_registry.readers[phase], 1);
+	for (dev = dev_registry.buckets[amdgpu_device_hash(acc)]; dev;
+	     dev = dev->next) {
+		/* pairs with the barrier before the device is published */
+		memory_read_barrier();
+		if (dev->acc_base == acc && amdgpu_device_get_unless_zero(dev))
+			break;
+	}
+	atomic_add(&dev_registry.readers[phase], -1);
+
+	return dev;
+}
+
+/**
+ * Wait until no lookup can see an unlinked device anymore.
+ *
+ * Both phases are drained, lookups that start after the first switch
+ * cannot find the device and new lookups cannot hold up the second one.
+ *
+ * Must be called with dev_registry.mutex held.
+ */
+static void amdgpu_device_registry_sync(void)
+{
+	int32 phase;
+	unsigned i;
+
+	for (i = 0; i < 2; i++) {
+		phase = atomic_get(&dev_registry.phase) & 1;
+		atomic_set(&dev_registry.phase, phase ^ 1);
+		while (atomic_get(&dev_registry.readers[phase]))
+			sched_yield();
+	}
+}
+
+/**
+ * Set up the parts of a device that don't need the accelerant.
+ */
+static void amdgpu_device_init(amdgpu_device_handle dev)
+{
+	pthread_mutex_init(&dev->bo_table_mutex, NULL);
+	amdgpu_cs_sched_init(dev);
+	amdgpu_cs_implicit_sync_init(dev);
+	pthread_mutex_init(&dev->vmid_mutex, NULL);
+	amdgpu_info_cache_init(dev);
+	amdgpu_sensor_init(dev);
+	pthread_mutex_init(&dev->lazy_info_mutex, NULL);
+}
 
+/**
+ * Undo amdgpu_device_init(), drop the accelerant and free the device.
+ * The VA managers are not touched, they are only set up once the device
+ * initialized successfully.
+ */
+static void amdgpu_device_fini(amdgpu_device_handle dev)
+{
+	/* the sampler thread and the queues of zombie contexts use the
+	 * accelerant */
+	amdgpu_sensor_fini(dev);
+	amdgpu_cs_implicit_sync_fini(dev);
 	dev->acc_base->vt->ReleaseReference(dev->acc_base);
 
-	amdgpu_vamgr_deinit(&dev->vamgr_32);
-	amdgpu_vamgr_deinit(&dev->vamgr);
-	amdgpu_vamgr_deinit(&dev->vamgr_high_32);
-	amdgpu_vamgr_deinit(&dev->vamgr_high);
 	handle_table_fini(&dev->bo_handles);
 	handle_table_fini(&dev->bo_flink_names);
 	pthread_mutex_destroy(&dev->bo_table_mutex);
+	amdgpu_cs_sched_fini(dev);
+	pthread_mutex_destroy(&dev->vmid_mutex);
+	amdgpu_info_cache_fini(dev);
+	pthread_mutex_destroy(&dev->lazy_info_mutex);
+	amdgpu_cs_stats_fini(dev);
 	free(dev->marketing_name);
 	free(dev);
 }
 
+/**
+ * Free a device that is not in the registry anymore or never was.
+ */
+static void amdgpu_device_destroy(amdgpu_device_handle dev)
+{
+	amdgpu_vamgr_deinit(&dev->vamgr_32);
+	amdgpu_vamgr_deinit(&dev->vamgr);
+	amdgpu_vamgr_deinit(&dev->vamgr_high_32);
+	amdgpu_vamgr_deinit(&dev->vamgr_high);
+	amdgpu_device_fini(dev);
+}
+
+static void amdgpu_device_free_internal(amdgpu_device_handle dev)
+{
+	amdgpu_device_handle *node;
+	bool last;
+
+	pthread_mutex_lock(&dev_registry.mutex);
+	node = &dev_registry.buckets[amdgpu_device_hash(dev->acc_base)];
+	while (*node != dev)
+		node = &(*node)->next;
+	*node = dev->next;
+	amdgpu_device_registry_sync();
+	last = --dev_registry.count == 0;
+	pthread_mutex_unlock(&dev_registry.mutex);
+
+	amdgpu_device_destroy(dev);
+	if (last)
+		amdgpu_cs_pools_fini();
+}
+
 
 /**
  * Assignment between two amdgpu_device pointers with reference counting.
@@ -97,7 +228,7 @@ drm_public int amdgpu_device_initialize_haiku(struct accelerant_base *acc,
 					uint32_t *minor_version,
 					amdgpu_device_handle *device_handle)
 {
-	struct amdgpu_device *dev;
+	struct amdgpu_device *dev, *other, **bucket;
 	struct drm_version version;
 	int r;
 	uint32_t accel_working = 0;
@@ -105,35 +236,25 @@ drm_public int amdgpu_device_initialize_haiku(struct accelerant_base *acc,
 
 	*device_handle = NULL;
 
-	pthread_mutex_lock(&dev_mutex);
-
-	for (dev = dev_list; dev; dev = dev->next)
-		if (dev->acc_base == acc)
-			break;
-
-	if (dev) {
-		*major_version = dev->major_version;
-		*minor_version = dev->minor_version;
-		amdgpu_device_reference(device_handle, dev);
-		pthread_mutex_unlock(&dev_mutex);
-		return 0;
-	}
+	dev = amdgpu_device_lookup(acc);
+	if (dev)
+		goto found;
 
+	/* The device is set up without locking, so different accelerants
+	 * initialize concurrently. Only publishing it is serialized. */
 	dev = calloc(1, sizeof(struct amdgpu_device));
 	if (!dev) {
 		fprintf(stderr, "%s: calloc failed\n", __func__);
-		pthread_mutex_unlock(&dev_mutex);
 		return ENOMEM;
 	}
 
-	dev->acc_base = NULL;
-	dev->acc_drm = NULL;
-	dev->acc_amdgpu = NULL;
-
 	atomic_set(&dev->refcount, 1);
 
 	acc->vt->AcquireReference(acc);
 	dev->acc_base = acc;
+	/* everything amdgpu_device_fini() undoes is set up from here on */
+	amdgpu_device_init(dev);
+
 	dev->acc_drm = (accelerant_drm*)dev->acc_base->vt->QueryInterface(dev->acc_base, B_ACCELERANT_IFACE_DRM);
 	if (!dev->acc_drm) {
 		fprintf(stderr, "%s: Accelerant don't provide DRM interface\n", __func__);
@@ -146,6 +267,7 @@ drm_public int amdgpu_device_initialize_haiku(struct accelerant_base *acc,
 		r = EBADF;
 		goto cleanup;
 	}
+	dev->acc_amdgpu_vm = (accelerant_amdgpu_vm*)dev->acc_base->vt->QueryInterface(dev->acc_base, B_ACCELERANT_IFACE_AMDGPU_VM);
 
 	memset(&version, 0, sizeof(version));
 	dev->acc_drm->vt->DrmVersion(dev->acc_drm, &version);
@@ -163,8 +285,6 @@ drm_public int amdgpu_device_initialize_haiku(struct accelerant_base *acc,
 	dev->major_version = version.version_major;
 	dev->minor_version = version.version_minor;
 
-	pthread_mutex_init(&dev->bo_table_mutex, NULL);
-
 	/* Check if acceleration is working. */
 	r = amdgpu_query_info(dev, AMDGPU_INFO_ACCEL_WORKING, 4, &accel_working);
 	if (r) {
@@ -183,6 +303,8 @@ drm_public int amdgpu_device_initialize_haiku(struct accelerant_base *acc,
 		fprintf(stderr, "%s: amdgpu_query_gpu_info_init failed\n", __func__);
 		goto cleanup;
 	}
+	/* the registers stay lazy without a snapshot */
+	amdgpu_device_cache_load(dev);
 
 	start = dev->dev_info.virtual_address_offset;
 	max = MIN2(dev->dev_info.virtual_address_max, 0x100000000ULL);
@@ -206,25 +328,119 @@ drm_public int amdgpu_device_initialize_haiku(struct accelerant_base *acc,
 	amdgpu_vamgr_init(&dev->vamgr_high, start, max,
 			  dev->dev_info.virtual_address_alignment);
 
-	amdgpu_parse_asic_ids(dev);
+	pthread_mutex_lock(&dev_registry.mutex);
+
+	/* lost the race against another open of the same accelerant */
+	other = amdgpu_device_lookup(acc);
+	if (other) {
+		pthread_mutex_unlock(&dev_registry.mutex);
+		amdgpu_device_destroy(dev);
+		dev = other;
+		goto found;
+	}
+
+	bucket = &dev_registry.buckets[amdgpu_device_hash(acc)];
+	dev->next = *bucket;
+	/* lock-free lookups must see the device initialized */
+	memory_write_barrier();
+	*bucket = dev;
+	dev_registry.count++;
+	pthread_mutex_unlock(&dev_registry.mutex);
 
+found:
 	*major_version = dev->major_version;
 	*minor_version = dev->minor_version;
 	*device_handle = dev;
-	dev->next = dev_list;
-	dev_list = dev;
-	pthread_mutex_unlock(&dev_mutex);
-
 	return 0;
 
 cleanup:
-	if (dev->acc_base != NULL)
-		dev->acc_base->vt->ReleaseReference(dev->acc_base);
-	free(dev);
-	pthread_mutex_unlock(&dev_mutex);
+	amdgpu_device_fini(dev);
 	return r;
 }
 
+#define AMDGPU_DEVICE_MAX_DRM_DEVICES 64
+#define AMDGPU_PCI_VENDOR_ID 0x1002
+
+struct amdgpu_device_init_job {
+	pthread_t thread;
+	const char *node;
+	bool started;
+	amdgpu_device_handle dev;
+	int r;
+};
+
+static void *amdgpu_device_init_thread(void *data)
+{
+	struct amdgpu_device_init_job *job = data;
+	uint32_t major_version, minor_version;
+	int fd;
+
+	fd = open(job->node, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		job->r = errno;
+		return NULL;
+	}
+
+	job->r = amdgpu_device_initialize(fd, &major_version, &minor_version,
+					  &job->dev);
+	close(fd);
+	return NULL;
+}
+
+drm_public int amdgpu_device_initialize_all(uint32_t max_devices,
+					    amdgpu_device_handle *devices,
+					    uint32_t *num_devices)
+{
+	drmDevicePtr drm_devices[AMDGPU_DEVICE_MAX_DRM_DEVICES];
+	struct amdgpu_device_init_job jobs[AMDGPU_DEVICE_MAX_DRM_DEVICES] = {};
+	int i, num_drm_devices, num_jobs = 0;
+	uint32_t count = 0;
+
+	if (!devices || !num_devices)
+		return EINVAL;
+
+	*num_devices = 0;
+
+	num_drm_devices = drmGetDevices2(0, drm_devices,
+					 AMDGPU_DEVICE_MAX_DRM_DEVICES);
+	if (num_drm_devices < 0)
+		return -num_drm_devices;
+
+	for (i = 0; i < num_drm_devices; i++) {
+		drmDevicePtr drm_dev = drm_devices[i];
+		struct amdgpu_device_init_job *job = &jobs[num_jobs];
+
+		if ((uint32_t)num_jobs == max_devices)
+			break;
+		if (drm_dev->bustype != DRM_BUS_PCI ||
+		    drm_dev->deviceinfo.pci->vendor_id != AMDGPU_PCI_VENDOR_ID ||
+		    !(drm_dev->available_nodes & (1 << DRM_NODE_RENDER)))
+			continue;
+
+		job->node = drm_dev->nodes[DRM_NODE_RENDER];
+		job->started = !pthread_create(&job->thread, NULL,
+					       amdgpu_device_init_thread, job);
+		if (!job->started)
+			/* initialize it here instead */
+			amdgpu_device_init_thread(job);
+		num_jobs++;
+	}
+
+	for (i = 0; i < num_jobs; i++) {
+		if (jobs[i].started)
+			pthread_join(jobs[i].thread, NULL);
+		if (jobs[i].r)
+			fprintf(stderr, "%s: %s: initialization failed (%i)\n",
+				__func__, jobs[i].node, jobs[i].r);
+		else
+			devices[count++] = jobs[i].dev;
+	}
+
+	drmFreeDevices(drm_devices, num_drm_devices);
+	*num_devices = count;
+	return 0;
+}
+
 drm_public int amdgpu_device_deinitialize(amdgpu_device_handle dev)
 {
 	amdgpu_device_reference(&dev, NULL);
@@ -238,6 +454,16 @@ drm_public accelerant_base *amdgpu_device_get_accelerant(amdgpu_device_handle de
 
 drm_public const char *amdgpu_get_marketing_name(amdgpu_device_handle dev)
 {
+	if (!atomic_get(&dev->marketing_name_parsed)) {
+		pthread_mutex_lock(&dev->lazy_info_mutex);
+		if (!atomic_get(&dev->marketing_name_parsed)) {
+			amdgpu_parse_asic_ids(dev);
+			/* atomic_set() orders the name before the flag */
+			atomic_set(&dev->marketing_name_parsed, 1);
+		}
+		pthread_mutex_unlock(&dev->lazy_info_mutex);
+	}
+
 	return dev->marketing_name;
 }
 
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2026 libdrm_amdgpu contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * \file amdgpu_device_cache.c
+ *
+ *  Snapshot of the register part of amdgpu_gpu_info on disk, so
+ *  short-lived processes don't read the registers again. The cache is only
+ *  used if LIBDRM_AMDGPU_INFO_CACHE names a directory. A snapshot is
+ *  valid while the DRM version and the AMDGPU_INFO_DEV_INFO answer, which
+ *  every device queries anyway, are the same.
+ *
+ */
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+
+#define AMDGPU_DEVICE_CACHE_MAGIC	0x46434441	/* "ADCF" */
+#define AMDGPU_DEVICE_CACHE_VERSION	3
+
+struct amdgpu_device_cache_file {
+	uint32_t magic;
+	uint32_t version;
+	/** Size of this struct, catches layout changes of the info structs */
+	uint32_t size;
+	/** The key, a driver update may change the registers */
+	uint32_t drm_major;
+	uint32_t drm_minor;
+	struct drm_amdgpu_info_device dev_info;
+	struct amdgpu_gpu_info info;
+};
+
+static int amdgpu_device_cache_path(amdgpu_device_handle dev, char *path,
+				    size_t size)
+{
+	const char *dir = getenv("LIBDRM_AMDGPU_INFO_CACHE");
+	int n;
+
+	if (!dir || !dir[0])
+		return ENOENT;
+
+	n = snprintf(path, size, "%s/amdgpu-%04x-%02x", dir,
+		     dev->dev_info.device_id, dev->dev_info.pci_rev);
+	return n < 0 || (size_t)n >= size ? ENAMETOOLONG : 0;
+}
+
+/**
+ * Take the registers from the snapshot of the device, if there is a valid
+ * one. dev_info must be queried already.
+ *
+ * \return  0 on success otherwise POSIX Error code
+ */
+drm_private int amdgpu_device_cache_load(amdgpu_device_handle dev)
+{
+	struct amdgpu_device_cache_file file;
+	char path[PATH_MAX];
+	ssize_t n;
+	int fd, r;
+
+	r = amdgpu_device_cache_path(dev, path, sizeof(path));
+	if (r)
+		return r;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return errno;
+	n = read(fd, &file, sizeof(file));
+	close(fd);
+
+	if (n != sizeof(file) || file.magic != AMDGPU_DEVICE_CACHE_MAGIC ||
+	    file.version != AMDGPU_DEVICE_CACHE_VERSION ||
+	    file.size != sizeof(file))
+		return EINVAL;
+	/* identical boards with different dev_info share the file */
+	if (file.drm_major != dev->major_version ||
+	    file.drm_minor != dev->minor_version ||
+	    memcmp(&file.dev_info, &dev->dev_info, sizeof(file.dev_info)))
+		return ESTALE;
+
+	dev->info = file.info;
+	atomic_set(&dev->info_registers_read, 1);
+	return 0;
+}
+
+/**
+ * Write the snapshot of a device whose registers were just read.
+ * Failures only cost the next process the register reads.
+ */
+drm_private void amdgpu_device_cache_store(amdgpu_device_handle dev)
+{
+	struct amdgpu_device_cache_file file;
+	char path[PATH_MAX], tmp_path[PATH_MAX + 8];
+	ssize_t n;
+	int fd;
+
+	if (amdgpu_device_cache_path(dev, path, sizeof(path)))
+		return;
+
+	memset(&file, 0, sizeof(file));
+	file.magic = AMDGPU_DEVICE_CACHE_MAGIC;
+	file.version = AMDGPU_DEVICE_CACHE_VERSION;
+	file.size = sizeof(file);
+	file.drm_major = dev->major_version;
+	file.drm_minor = dev->minor_version;
+	file.dev_info = dev->dev_info;
+	file.info = dev->info;
+
+	/* readers never see a partially written snapshot */
+	snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+	fd = mkstemp(tmp_path);
+	if (fd < 0)
+		return;
+	fchmod(fd, 0644);
+	n = write(fd, &file, sizeof(file));
+	close(fd);
+
+	if (n != sizeof(file) || rename(tmp_path, path))
+		unlink(tmp_path);
+}
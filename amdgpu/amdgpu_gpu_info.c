@@ -23,12 +23,147 @@
  */
 
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "amdgpu.h"
 #include "amdgpu_drm.h"
 #include "amdgpu_internal.h"
 #include "xf86drm.h"
+#include "util_math.h"
+
+/**
+ * Answer of an immutable query. Entries are never changed or freed while
+ * the device lives, so lookups need no lock.
+ */
+struct amdgpu_info_cache_entry {
+	struct amdgpu_info_cache_entry *next;
+	/** The request with return_pointer cleared. */
+	struct drm_amdgpu_info request;
+	uint8_t data[];
+};
+
+static bool amdgpu_info_is_immutable(uint32_t query)
+{
+	switch (query) {
+	case AMDGPU_INFO_HW_IP_INFO:
+	case AMDGPU_INFO_HW_IP_COUNT:
+	case AMDGPU_INFO_FW_VERSION:
+	case AMDGPU_INFO_GDS_CONFIG:
+	case AMDGPU_INFO_DEV_INFO:
+	case AMDGPU_INFO_VCE_CLOCK_TABLE:
+	case AMDGPU_INFO_VIDEO_CAPS:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static unsigned amdgpu_info_cache_hash(const struct drm_amdgpu_info *request)
+{
+	const uint32_t *words = (const uint32_t *)request;
+	uint32_t hash = 2166136261u;
+	unsigned i;
+
+	for (i = 0; i < sizeof(*request) / sizeof(uint32_t); i++)
+		hash = (hash ^ words[i]) * 16777619u;
+
+	return hash % AMDGPU_INFO_CACHE_BUCKETS;
+}
+
+static struct amdgpu_info_cache_entry *
+amdgpu_info_cache_find(struct amdgpu_info_cache_entry *entry,
+		       const struct drm_amdgpu_info *request)
+{
+	for (; entry; entry = entry->next) {
+		if (!memcmp(&entry->request, request, sizeof(*request)))
+			return entry;
+	}
+
+	return NULL;
+}
+
+/**
+ * Pass a query to the accelerant, answering immutable ones from the
+ * cache of the device after the first time.
+ */
+static int amdgpu_query_info_raw(amdgpu_device_handle dev,
+				 struct drm_amdgpu_info *request)
+{
+	struct amdgpu_info_cache_entry *entry, **bucket;
+	struct drm_amdgpu_info key;
+	int r;
+
+	if (!amdgpu_info_is_immutable(request->query))
+		return dev->acc_amdgpu->vt->AmdgpuQueryInfo(dev->acc_amdgpu, request);
+
+	key = *request;
+	key.return_pointer = 0;
+	bucket = &dev->info_cache[amdgpu_info_cache_hash(&key)];
+
+	entry = *bucket;
+	/* pairs with the barrier before an entry is published */
+	memory_read_barrier();
+	entry = amdgpu_info_cache_find(entry, &key);
+	if (entry) {
+		memcpy((void *)(uintptr_t)request->return_pointer, entry->data,
+		       request->return_size);
+		return 0;
+	}
+
+	pthread_mutex_lock(&dev->info_cache_mutex);
+
+	entry = amdgpu_info_cache_find(*bucket, &key);
+	if (entry) {
+		memcpy((void *)(uintptr_t)request->return_pointer, entry->data,
+		       request->return_size);
+		r = 0;
+		goto out;
+	}
+
+	r = dev->acc_amdgpu->vt->AmdgpuQueryInfo(dev->acc_amdgpu, request);
+	if (r)
+		goto out;
+
+	/* not caching is fine, the answer is correct anyway */
+	entry = malloc(sizeof(*entry) + request->return_size);
+	if (!entry)
+		goto out;
+
+	entry->request = key;
+	memcpy(entry->data, (void *)(uintptr_t)request->return_pointer,
+	       request->return_size);
+	entry->next = *bucket;
+	/* lock-free readers must see the entry filled */
+	memory_write_barrier();
+	*bucket = entry;
+
+out:
+	pthread_mutex_unlock(&dev->info_cache_mutex);
+	return r;
+}
+
+drm_private void amdgpu_info_cache_init(amdgpu_device_handle dev)
+{
+	pthread_mutex_init(&dev->info_cache_mutex, NULL);
+	pthread_mutex_init(&dev->heap_info_mutex, NULL);
+}
+
+drm_private void amdgpu_info_cache_fini(amdgpu_device_handle dev)
+{
+	struct amdgpu_info_cache_entry *entry, *next;
+	unsigned i;
+
+	for (i = 0; i < AMDGPU_INFO_CACHE_BUCKETS; i++) {
+		for (entry = dev->info_cache[i]; entry; entry = next) {
+			next = entry->next;
+			free(entry);
+		}
+	}
+	pthread_mutex_destroy(&dev->info_cache_mutex);
+	pthread_mutex_destroy(&dev->heap_info_mutex);
+}
 
 drm_public int amdgpu_query_info(amdgpu_device_handle dev, unsigned info_id,
 				 unsigned size, void *value)
@@ -40,7 +175,7 @@ drm_public int amdgpu_query_info(amdgpu_device_handle dev, unsigned info_id,
 	request.return_size = size;
 	request.query = info_id;
 
-	return dev->acc_amdgpu->vt->AmdgpuQueryInfo(dev->acc_amdgpu, &request);
+	return amdgpu_query_info_raw(dev, &request);
 }
 
 drm_public int amdgpu_query_crtc_from_id(amdgpu_device_handle dev, unsigned id,
@@ -54,7 +189,7 @@ drm_public int amdgpu_query_crtc_from_id(amdgpu_device_handle dev, unsigned id,
 	request.query = AMDGPU_INFO_CRTC_FROM_ID;
 	request.mode_crtc.id = id;
 
-	return dev->acc_amdgpu->vt->AmdgpuQueryInfo(dev->acc_amdgpu, &request);
+	return amdgpu_query_info_raw(dev, &request);
 }
 
 drm_public int amdgpu_read_mm_registers(amdgpu_device_handle dev,
@@ -72,7 +207,43 @@ drm_public int amdgpu_read_mm_registers(amdgpu_device_handle dev,
 	request.read_mmr_reg.instance = instance;
 	request.read_mmr_reg.flags = flags;
 
-	return dev->acc_amdgpu->vt->AmdgpuQueryInfo(dev->acc_amdgpu, &request);
+	return amdgpu_query_info_raw(dev, &request);
+}
+
+drm_public int amdgpu_read_mm_registers_batch(amdgpu_device_handle dev,
+		uint32_t number_of_ranges,
+		const struct amdgpu_mm_register_range *ranges,
+		uint32_t *values)
+{
+	uint32_t i, count;
+	int r;
+
+	if (!dev || (number_of_ranges && (!ranges || !values)))
+		return EINVAL;
+
+	for (i = 0; i < number_of_ranges; i += count) {
+		uint32_t num_regs = ranges[i].count;
+
+		/* merge the ranges continuing this one */
+		for (count = 1; i + count < number_of_ranges; count++) {
+			const struct amdgpu_mm_register_range *next = &ranges[i + count];
+
+			if (next->dword_offset != ranges[i].dword_offset + num_regs ||
+			    next->instance != ranges[i].instance ||
+			    next->flags != ranges[i].flags)
+				break;
+			num_regs += next->count;
+		}
+
+		r = amdgpu_read_mm_registers(dev, ranges[i].dword_offset,
+					     num_regs, ranges[i].instance,
+					     ranges[i].flags, values);
+		if (r)
+			return r;
+		values += num_regs;
+	}
+
+	return 0;
 }
 
 drm_public int amdgpu_query_hw_ip_count(amdgpu_device_handle dev,
@@ -87,7 +258,7 @@ drm_public int amdgpu_query_hw_ip_count(amdgpu_device_handle dev,
 	request.query = AMDGPU_INFO_HW_IP_COUNT;
 	request.query_hw_ip.type = type;
 
-	return dev->acc_amdgpu->vt->AmdgpuQueryInfo(dev->acc_amdgpu, &request);
+	return amdgpu_query_info_raw(dev, &request);
 }
 
 drm_public int amdgpu_query_hw_ip_info(amdgpu_device_handle dev, unsigned type,
@@ -103,7 +274,7 @@ drm_public int amdgpu_query_hw_ip_info(amdgpu_device_handle dev, unsigned type,
 	request.query_hw_ip.type = type;
 	request.query_hw_ip.ip_instance = ip_instance;
 
-	return dev->acc_amdgpu->vt->AmdgpuQueryInfo(dev->acc_amdgpu, &request);
+	return amdgpu_query_info_raw(dev, &request);
 }
 
 drm_public int amdgpu_query_firmware_version(amdgpu_device_handle dev,
@@ -122,7 +293,7 @@ drm_public int amdgpu_query_firmware_version(amdgpu_device_handle dev,
 	request.query_fw.ip_instance = ip_instance;
 	request.query_fw.index = index;
 
-	return dev->acc_amdgpu->vt->AmdgpuQueryInfo(dev->acc_amdgpu, &request);
+	r = amdgpu_query_info_raw(dev, &request);
 	if (r)
 		return r;
 
@@ -131,9 +302,29 @@ drm_public int amdgpu_query_firmware_version(amdgpu_device_handle dev,
 	return 0;
 }
 
+/* Shader engines with registers in struct amdgpu_gpu_info */
+#define AMDGPU_GPU_INFO_MAX_SE		4
+/* Registers read by amdgpu_query_gpu_info_init(), per shader engine and
+ * global ones */
+#define AMDGPU_GPU_INFO_MAX_RANGES	(3 * AMDGPU_GPU_INFO_MAX_SE + 4)
+#define AMDGPU_GPU_INFO_MAX_VALUES	(3 * AMDGPU_GPU_INFO_MAX_SE + 1 + 32 + 16 + 1)
+
+static void amdgpu_gpu_info_add_range(struct amdgpu_mm_register_range *ranges,
+				      uint32_t **dst, unsigned *num_ranges,
+				      uint32_t dword_offset, uint32_t count,
+				      uint32_t instance, uint32_t *values)
+{
+	ranges[*num_ranges].dword_offset = dword_offset;
+	ranges[*num_ranges].count = count;
+	ranges[*num_ranges].instance = instance;
+	ranges[*num_ranges].flags = 0;
+	dst[*num_ranges] = values;
+	(*num_ranges)++;
+}
+
 drm_private int amdgpu_query_gpu_info_init(amdgpu_device_handle dev)
 {
-	int r, i;
+	int r;
 
 	r = amdgpu_query_info(dev, AMDGPU_INFO_DEV_INFO, sizeof(dev->dev_info),
 			      &dev->dev_info);
@@ -160,74 +351,110 @@ drm_private int amdgpu_query_gpu_info_init(amdgpu_device_handle dev)
 	dev->info.vce_harvest_config = dev->dev_info.vce_harvest_config;
 	dev->info.pci_rev_id = dev->dev_info.pci_rev;
 
+	dev->info.cu_active_number = dev->dev_info.cu_active_number;
+	dev->info.cu_ao_mask = dev->dev_info.cu_ao_mask;
+	memcpy(&dev->info.cu_bitmap[0][0], &dev->dev_info.cu_bitmap[0][0], sizeof(dev->info.cu_bitmap));
+
+	/* TODO: info->max_quad_shader_pipes is not set */
+	/* TODO: info->avail_quad_shader_pipes is not set */
+	/* TODO: info->cache_entries_per_quad_pipe is not set */
+	return 0;
+}
+
+/**
+ * Read the registers of struct amdgpu_gpu_info. Done on first use by
+ * amdgpu_query_gpu_info(), opening the device only queries dev_info.
+ */
+static int amdgpu_query_gpu_info_registers(amdgpu_device_handle dev)
+{
+	struct amdgpu_mm_register_range ranges[AMDGPU_GPU_INFO_MAX_RANGES];
+	uint32_t *dst[AMDGPU_GPU_INFO_MAX_RANGES];
+	uint32_t values[AMDGPU_GPU_INFO_MAX_VALUES], *v;
+	unsigned i, num_ranges, num_shader_engines;
+	int r;
+
+	num_ranges = 0;
+	num_shader_engines = MIN2(dev->info.num_shader_engines,
+				  AMDGPU_GPU_INFO_MAX_SE);
+
 	if (dev->info.family_id < AMDGPU_FAMILY_AI) {
-		for (i = 0; i < (int)dev->info.num_shader_engines; i++) {
+		for (i = 0; i < num_shader_engines; i++) {
 			unsigned instance = (i << AMDGPU_INFO_MMR_SE_INDEX_SHIFT) |
 					    (AMDGPU_INFO_MMR_SH_INDEX_MASK <<
 					     AMDGPU_INFO_MMR_SH_INDEX_SHIFT);
 
-			r = amdgpu_read_mm_registers(dev, 0x263d, 1, instance, 0,
-						     &dev->info.backend_disable[i]);
-			if (r)
-				return r;
-			/* extract bitfield CC_RB_BACKEND_DISABLE.BACKEND_DISABLE */
-			dev->info.backend_disable[i] =
-				(dev->info.backend_disable[i] >> 16) & 0xff;
+			amdgpu_gpu_info_add_range(ranges, dst, &num_ranges,
+						  0x263d, 1, instance,
+						  &dev->info.backend_disable[i]);
+			amdgpu_gpu_info_add_range(ranges, dst, &num_ranges,
+						  0xa0d4, 1, instance,
+						  &dev->info.pa_sc_raster_cfg[i]);
+			if (dev->info.family_id >= AMDGPU_FAMILY_CI)
+				amdgpu_gpu_info_add_range(ranges, dst, &num_ranges,
+							  0xa0d5, 1, instance,
+							  &dev->info.pa_sc_raster_cfg1[i]);
+		}
+	}
 
-			r = amdgpu_read_mm_registers(dev, 0xa0d4, 1, instance, 0,
-						     &dev->info.pa_sc_raster_cfg[i]);
-			if (r)
-				return r;
+	amdgpu_gpu_info_add_range(ranges, dst, &num_ranges, 0x263e, 1,
+				  0xffffffff, &dev->info.gb_addr_cfg);
 
-			if (dev->info.family_id >= AMDGPU_FAMILY_CI) {
-				r = amdgpu_read_mm_registers(dev, 0xa0d5, 1, instance, 0,
-						     &dev->info.pa_sc_raster_cfg1[i]);
-				if (r)
-					return r;
-			}
-		}
+	if (dev->info.family_id < AMDGPU_FAMILY_AI) {
+		amdgpu_gpu_info_add_range(ranges, dst, &num_ranges, 0x2644, 32,
+					  0xffffffff, dev->info.gb_tile_mode);
+		if (dev->info.family_id >= AMDGPU_FAMILY_CI)
+			amdgpu_gpu_info_add_range(ranges, dst, &num_ranges,
+						  0x2664, 16, 0xffffffff,
+						  dev->info.gb_macro_tile_mode);
+		amdgpu_gpu_info_add_range(ranges, dst, &num_ranges, 0x9d8, 1,
+					  0xffffffff, &dev->info.mc_arb_ramcfg);
 	}
 
-	r = amdgpu_read_mm_registers(dev, 0x263e, 1, 0xffffffff, 0,
-					     &dev->info.gb_addr_cfg);
+	r = amdgpu_read_mm_registers_batch(dev, num_ranges, ranges, values);
 	if (r)
 		return r;
 
-	if (dev->info.family_id < AMDGPU_FAMILY_AI) {
-		r = amdgpu_read_mm_registers(dev, 0x2644, 32, 0xffffffff, 0,
-					     dev->info.gb_tile_mode);
-		if (r)
-			return r;
-
-		if (dev->info.family_id >= AMDGPU_FAMILY_CI) {
-			r = amdgpu_read_mm_registers(dev, 0x2664, 16, 0xffffffff, 0,
-						     dev->info.gb_macro_tile_mode);
-			if (r)
-				return r;
-		}
+	for (i = 0, v = values; i < num_ranges; v += ranges[i].count, i++)
+		memcpy(dst[i], v, ranges[i].count * sizeof(uint32_t));
 
-		r = amdgpu_read_mm_registers(dev, 0x9d8, 1, 0xffffffff, 0,
-					     &dev->info.mc_arb_ramcfg);
-		if (r)
-			return r;
+	/* extract bitfield CC_RB_BACKEND_DISABLE.BACKEND_DISABLE */
+	if (dev->info.family_id < AMDGPU_FAMILY_AI) {
+		for (i = 0; i < num_shader_engines; i++)
+			dev->info.backend_disable[i] =
+				(dev->info.backend_disable[i] >> 16) & 0xff;
 	}
 
-	dev->info.cu_active_number = dev->dev_info.cu_active_number;
-	dev->info.cu_ao_mask = dev->dev_info.cu_ao_mask;
-	memcpy(&dev->info.cu_bitmap[0][0], &dev->dev_info.cu_bitmap[0][0], sizeof(dev->info.cu_bitmap));
-
-	/* TODO: info->max_quad_shader_pipes is not set */
-	/* TODO: info->avail_quad_shader_pipes is not set */
-	/* TODO: info->cache_entries_per_quad_pipe is not set */
 	return 0;
 }
 
 drm_public int amdgpu_query_gpu_info(amdgpu_device_handle dev,
 				     struct amdgpu_gpu_info *info)
 {
+	bool just_read = false;
+	int r;
+
 	if (!dev || !info)
 		return EINVAL;
 
+	if (!atomic_get(&dev->info_registers_read)) {
+		pthread_mutex_lock(&dev->lazy_info_mutex);
+		if (!atomic_get(&dev->info_registers_read)) {
+			r = amdgpu_query_gpu_info_registers(dev);
+			if (r) {
+				pthread_mutex_unlock(&dev->lazy_info_mutex);
+				return r;
+			}
+			/* atomic_set() orders the registers before the flag */
+			atomic_set(&dev->info_registers_read, 1);
+			just_read = true;
+		}
+		pthread_mutex_unlock(&dev->lazy_info_mutex);
+	}
+
+	/* info doesn't change anymore, write it without the lock */
+	if (just_read)
+		amdgpu_device_cache_store(dev);
+
 	/* Get ASIC info*/
 	*info = dev->info;
 
@@ -286,6 +513,57 @@ drm_public int amdgpu_query_heap_info(amdgpu_device_handle dev,
 	return 0;
 }
 
+static void amdgpu_heap_info_from_memory(struct amdgpu_heap_info *info,
+					 const struct drm_amdgpu_heap_info *heap)
+{
+	info->heap_size = heap->usable_heap_size;
+	info->heap_usage = heap->heap_usage;
+	info->max_allocation = heap->max_allocation;
+}
+
+drm_public int amdgpu_query_heap_info_all(amdgpu_device_handle dev,
+					  uint64_t max_age_ns,
+					  struct amdgpu_heap_info_all *info)
+{
+	struct drm_amdgpu_memory_info memory = {};
+	uint64_t now = 0;
+	int r;
+
+	if (!dev || !info)
+		return EINVAL;
+
+	if (max_age_ns) {
+		now = amdgpu_cs_current_time();
+
+		pthread_mutex_lock(&dev->heap_info_mutex);
+		if (dev->heap_info_time && now - dev->heap_info_time <= max_age_ns) {
+			*info = dev->heap_info;
+			pthread_mutex_unlock(&dev->heap_info_mutex);
+			return 0;
+		}
+		pthread_mutex_unlock(&dev->heap_info_mutex);
+	}
+
+	r = amdgpu_query_info(dev, AMDGPU_INFO_MEMORY, sizeof(memory), &memory);
+	if (r)
+		return r;
+
+	amdgpu_heap_info_from_memory(&info->vram, &memory.vram);
+	amdgpu_heap_info_from_memory(&info->vram_cpu_accessible,
+				     &memory.cpu_accessible_vram);
+	amdgpu_heap_info_from_memory(&info->gtt, &memory.gtt);
+
+	if (!now)
+		now = amdgpu_cs_current_time();
+
+	pthread_mutex_lock(&dev->heap_info_mutex);
+	dev->heap_info = *info;
+	dev->heap_info_time = now;
+	pthread_mutex_unlock(&dev->heap_info_mutex);
+
+	return 0;
+}
+
 drm_public int amdgpu_query_gds_info(amdgpu_device_handle dev,
 				     struct amdgpu_gds_resource_info *gds_info)
 {
@@ -322,7 +600,7 @@ drm_public int amdgpu_query_sensor_info(amdgpu_device_handle dev, unsigned senso
 	request.query = AMDGPU_INFO_SENSOR;
 	request.sensor_info.type = sensor_type;
 
-	return dev->acc_amdgpu->vt->AmdgpuQueryInfo(dev->acc_amdgpu, &request);
+	return amdgpu_query_info_raw(dev, &request);
 }
 
 drm_public int amdgpu_query_video_caps_info(amdgpu_device_handle dev, unsigned cap_type,
@@ -336,5 +614,5 @@ drm_public int amdgpu_query_video_caps_info(amdgpu_device_handle dev, unsigned c
 	request.query = AMDGPU_INFO_VIDEO_CAPS;
 	request.sensor_info.type = cap_type;
 
-	return dev->acc_amdgpu->vt->AmdgpuQueryInfo(dev->acc_amdgpu, &request);
+	return amdgpu_query_info_raw(dev, &request);
 }
@@ -37,10 +37,29 @@
 #include <AccelerantRoster.h>
 #include <AccelerantDrm.h>
 #include <AccelerantAmdgpu.h>
+#include "AccelerantAmdgpuVm.h"
 
 typedef int32 atomic_t;
 
+/* AMDGPU_INFO_SENSOR_* types the sensor sampler can record */
+#define AMDGPU_SENSOR_TYPES 16
+
+/* Hash buckets of the per device cache of AMDGPU_INFO_* answers */
+#define AMDGPU_INFO_CACHE_BUCKETS 32
+
 #define AMDGPU_CS_MAX_RINGS 8
+/* requests queued per asynchronous context, must be a power of 2 */
+#define AMDGPU_CS_QUEUE_SIZE 64
+#define AMDGPU_CS_PRIORITY_CLASSES 5
+/* longest time a worker holds back for requests of higher priority */
+#define AMDGPU_CS_PRIORITY_YIELD_NS 2000000ull
+/* sequence number translations kept per ring, must be a power of 2 */
+#define AMDGPU_CS_SEQ_WINDOW 256
+/* longest time amdgpu_cs_chunk_fence_to_dep() waits for a queued fence */
+#define AMDGPU_CS_DEP_TIMEOUT_NS 1000000000ull
+/* waiting for any fence blocks on one at a time for a slice in this range */
+#define AMDGPU_CS_WAIT_ANY_SLICE_MIN_NS 50000ull
+#define AMDGPU_CS_WAIT_ANY_SLICE_MAX_NS 2000000ull
 /* do not use below macro if b is not power of 2 aligned value */
 #define __round_mask(x, y) ((__typeof__(x))((y)-1))
 #define ROUND_UP(x, y) ((((x)-1) | __round_mask(x, y))+1)
@@ -76,9 +95,12 @@ struct amdgpu_device {
 	accelerant_base *acc_base;
 	accelerant_drm *acc_drm;
 	accelerant_amdgpu *acc_amdgpu;
+	/** NULL if the accelerant has no VM operations. */
+	accelerant_amdgpu_vm *acc_amdgpu_vm;
 	unsigned major_version;
 	unsigned minor_version;
 
+	/** Read from amdgpu.ids on first use, see marketing_name_parsed. */
 	char *marketing_name;
 	/** List of buffer handles. Protected by bo_table_mutex. */
 	struct handle_table bo_handles;
@@ -87,7 +109,51 @@ struct amdgpu_device {
 	/** This protects all hash tables. */
 	pthread_mutex_t bo_table_mutex;
 	struct drm_amdgpu_info_device dev_info;
+	/** Filled from dev_info when the device is opened, the registers
+	    only when first queried, see info_registers_read. */
 	struct amdgpu_gpu_info info;
+	/** Serializes the lazy initialization of info and marketing_name.
+	    The flags are set once it is done and read without the mutex. */
+	pthread_mutex_t lazy_info_mutex;
+	atomic_t info_registers_read;
+	atomic_t marketing_name_parsed;
+	/** Answers of immutable AMDGPU_INFO_* queries. Buckets are only
+	    written under info_cache_mutex and read without it. */
+	struct amdgpu_info_cache_entry *info_cache[AMDGPU_INFO_CACHE_BUCKETS];
+	pthread_mutex_t info_cache_mutex;
+	/** Last amdgpu_query_heap_info_all() answer and the CLOCK_MONOTONIC
+	    time it was queried at, 0 if none. Protected by heap_info_mutex. */
+	pthread_mutex_t heap_info_mutex;
+	struct amdgpu_heap_info_all heap_info;
+	uint64_t heap_info_time;
+	/** Sample rings per AMDGPU_INFO_SENSOR_* type, published once and
+	    read without a lock. */
+	struct amdgpu_sensor_ring *sensor_rings[AMDGPU_SENSOR_TYPES];
+	/** Running sampler, NULL if none. Protected by sensor_mutex. */
+	struct amdgpu_sensor_sampler *sensor_sampler;
+	pthread_mutex_t sensor_mutex;
+	/** available_rings of each IP, 0 until queried. */
+	atomic_t ring_mask[AMDGPU_HW_IP_NUM][AMDGPU_HW_IP_INSTANCE_MAX_COUNT];
+	/** Requests queued by asynchronous contexts per priority class. */
+	atomic_t cs_queued[AMDGPU_CS_PRIORITY_CLASSES];
+	/** Workers holding back for higher priority requests wait on
+	    cs_sched_cond, broadcast when a priority class drains. */
+	pthread_mutex_t cs_sched_mutex;
+	pthread_cond_t cs_sched_cond;
+	atomic_t cs_sched_waiters;
+	/** Command submission statistics, allocated when first enabled. */
+	struct amdgpu_cs_stats *cs_stats;
+	atomic_t cs_stats_enabled;
+	/** Serializes implicitly synchronized submissions, protects the
+	    sync state of all BOs and implicit_sync_zombies. */
+	pthread_mutex_t implicit_sync_mutex;
+	/** Freed contexts whose implicitly synchronized submissions may still
+	    run, their kernel context is freed once these completed. */
+	struct list_head implicit_sync_zombies;
+	/** Outstanding amdgpu_vm_reserve_vmid() calls. Protected by
+	    vmid_mutex. */
+	pthread_mutex_t vmid_mutex;
+	uint32_t vmid_reservations;
 	/** The VA manager for the lower virtual address space */
 	struct amdgpu_bo_va_mgr vamgr;
 	/** The VA manager for the 32bit address space */
@@ -98,6 +164,31 @@ struct amdgpu_device {
 	struct amdgpu_bo_va_mgr vamgr_high_32;
 };
 
+struct amdgpu_cs_stats {
+	struct amdgpu_cs_ring_stats rings[AMDGPU_HW_IP_NUM][AMDGPU_HW_IP_INSTANCE_MAX_COUNT][AMDGPU_CS_MAX_RINGS];
+};
+
+/**
+ * Fence recorded for implicit synchronization. \c serial tells whether
+ * \c fence.context is still the context that submitted it.
+ */
+struct amdgpu_bo_sync_fence {
+	struct amdgpu_cs_fence fence;
+	uint64_t serial;
+};
+
+/**
+ * Last accesses to a BO by implicitly synchronized contexts: the last
+ * write and, per ring, the last read since. Protected by the
+ * implicit_sync_mutex of the device.
+ */
+struct amdgpu_bo_sync {
+	struct amdgpu_bo_sync_fence write;
+	uint32_t num_reads;
+	uint32_t max_reads;
+	struct amdgpu_bo_sync_fence *reads;
+};
+
 struct amdgpu_bo {
 	atomic_t refcount;
 	struct amdgpu_device *dev;
@@ -110,23 +201,173 @@ struct amdgpu_bo {
 	pthread_mutex_t cpu_access_mutex;
 	void *cpu_ptr;
 	int64_t cpu_map_count;
+
+	struct amdgpu_bo_sync sync;
 };
 
 struct amdgpu_bo_list {
 	struct amdgpu_device *dev;
 
 	uint32_t handle;
+	uint32_t number_of_resources;
+	amdgpu_bo_handle *resources;
+	/** AMDGPU_BO_USAGE_* flags of each resource. */
+	uint32_t *usage;
+};
+
+/**
+ * User fence location of a ring. The GPU writes the sequence number of
+ * every completed submission there, so fence status can be checked with
+ * a plain memory read instead of a call into the accelerant.
+ *
+ * The location is recorded on the first submission with a user fence and
+ * is only trusted while all user fenced submissions of the ring keep
+ * using it. \c valid is cleared otherwise; the mapping itself stays alive
+ * until the context is freed so that lock-free readers never see it go away.
+ */
+struct amdgpu_cs_user_fence {
+	atomic_t valid;
+	amdgpu_bo_handle bo;
+	uint64_t offset;
+	volatile uint64_t *cpu;
+	/* first and last kernel sequence number written by this ring */
+	uint64_t first_seq;
+	uint64_t last_seq;
+};
+
+/**
+ * Submission waiting in the queue of an asynchronous context.
+ *
+ * The IB and dependency arrays belong to the queue slot and only ever
+ * grow, so queueing does not allocate once the queue has warmed up.
+ */
+struct amdgpu_cs_queued_request {
+	struct amdgpu_cs_seq_map *seq_map;
+	unsigned ip_type;
+	unsigned ip_instance;
+	uint32_t ring;
+	uint32_t bo_list_handle;
+	struct amdgpu_cs_fence_info fence_info;
+	/* library sequence number */
+	uint64_t seq_no;
+	/* CLOCK_MONOTONIC time it was queued at, only set when coalescing */
+	uint64_t queued_ns;
+	/* priority class of the context when it was queued */
+	unsigned priority_class;
+	uint32_t number_of_ibs;
+	uint32_t max_ibs;
+	struct amdgpu_cs_ib_info *ibs;
+	/* explicit dependencies followed by semaphore dependencies */
+	uint32_t number_of_dependencies;
+	uint32_t max_dependencies;
+	struct amdgpu_cs_fence *dependencies;
+};
+
+/**
+ * Kernel sequence numbers of the last AMDGPU_CS_SEQ_WINDOW library
+ * sequence numbers of a ring of an asynchronous context.
+ *
+ * Written by the worker only: \c writing is raised before slots are
+ * overwritten and \c submitted after, so readers can detect a slot that
+ * changed under them without taking a lock.
+ */
+struct amdgpu_cs_seq_map {
+	uint64_t writing;
+	uint64_t submitted;
+	/** Kernel sequence number of the last successful submission. */
+	uint64_t last_kernel_seq;
+	uint64_t kernel_seq[AMDGPU_CS_SEQ_WINDOW];
+};
+
+/**
+ * Request queue of an asynchronous context.
+ *
+ * Producers are serialized by sequence_mutex, so there is a single
+ * producer writing \c head and a single worker writing \c tail and the
+ * queue itself needs no lock. \c mutex and the condition variables are
+ * only used to put the worker or waiters to sleep.
+ */
+struct amdgpu_cs_queue {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	/** Signaled when requests are queued while the worker is idle. */
+	pthread_cond_t work_cond;
+	/** Broadcast whenever the worker handed requests to the kernel. */
+	pthread_cond_t done_cond;
+	atomic_t worker_idle;
+	atomic_t quit;
+	/** How long the worker waits for more requests to merge, in us. */
+	atomic_t coalesce_window_us;
+	/** Maximum number of IBs of a merged submission. */
+	atomic_t coalesce_ibs;
+	/** Set by fence waiters to submit the next batch right away. */
+	atomic_t flush;
+	/** Set while the worker holds back for higher priority requests. */
+	atomic_t yielding;
+	/** Error of a failed submission, returned by the next amdgpu_cs_submit(). */
+	atomic_t error;
+	atomic_t head;
+	atomic_t tail;
+	struct amdgpu_cs_queued_request requests[AMDGPU_CS_QUEUE_SIZE];
+};
+
+/**
+ * Semaphore waits of a ring, consumed as dependencies by its next
+ * submission. The array only grows and is copied as is into the request.
+ */
+struct amdgpu_cs_sem_deps {
+	uint32_t count;
+	uint32_t size;
+	struct amdgpu_cs_fence *fences;
+};
+
+/**
+ * Submission state of a ring of a context. Allocated under sequence_mutex
+ * when the ring is first used and kept until the context is freed.
+ */
+struct amdgpu_cs_ring {
+	/** Next ring used by the context. */
+	struct amdgpu_cs_ring *next;
+	uint64_t last_seq;
+	/** Highest sequence number known to be signaled, only ever grows.
+	    Accessed atomically without sequence_mutex. */
+	uint64_t last_signaled_seq;
+	struct amdgpu_cs_sem_deps sem_deps;
+	struct amdgpu_cs_user_fence user_fence;
+	/** Translation of library sequence numbers, asynchronous contexts only. */
+	struct amdgpu_cs_seq_map *seq_map;
 };
 
 struct amdgpu_context {
 	struct amdgpu_device *dev;
+	/** Link in the pool of free contexts. */
+	struct list_head list;
 	/** Mutex for accessing fences and to maintain command submissions
 	    in good sequence. */
 	pthread_mutex_t sequence_mutex;
 	/* context id*/
 	uint32_t id;
-	uint64_t last_seq[AMDGPU_HW_IP_NUM][AMDGPU_HW_IP_INSTANCE_MAX_COUNT][AMDGPU_CS_MAX_RINGS];
-	struct list_head sem_list[AMDGPU_HW_IP_NUM][AMDGPU_HW_IP_INSTANCE_MAX_COUNT][AMDGPU_CS_MAX_RINGS];
+	/** AMDGPU_CTX_PRIORITY_* of the context, changed by
+	    amdgpu_cs_ctx_override_priority(). */
+	atomic_t priority;
+	/** Rings used so far, also reachable through ring_list. Entries are
+	    published once and may be looked up without sequence_mutex. */
+	struct amdgpu_cs_ring *rings[AMDGPU_HW_IP_NUM][AMDGPU_HW_IP_INSTANCE_MAX_COUNT][AMDGPU_CS_MAX_RINGS];
+	struct amdgpu_cs_ring *ring_list;
+	/** Submission queue, NULL unless asynchronous submission is enabled.
+	    Sequence numbers of such a context are assigned by the library. */
+	struct amdgpu_cs_queue *queue;
+	/** Serial of the fences the context recorded for implicit sync, 0 if
+	    it did not enable it since it was created. Recorded fences with
+	    another serial are ignored. Protected by implicit_sync_mutex. */
+	uint64_t implicit_sync_serial;
+	/** Submissions are implicitly synchronized. */
+	bool implicit_sync;
+	/** BOs may still point at the context, so it is pooled instead of
+	    freed. Survives the reuse of the context. */
+	bool implicit_sync_pinned;
+	/** Link in implicit_sync_zombies of the device. */
+	struct list_head implicit_sync_link;
 };
 
 /**
@@ -135,6 +376,7 @@ struct amdgpu_context {
  */
 struct amdgpu_semaphore {
 	atomic_t refcount;
+	/** Link in the pool of free semaphores. */
 	struct list_head list;
 	struct amdgpu_cs_fence signal_fence;
 };
@@ -152,12 +394,134 @@ drm_private void amdgpu_parse_asic_ids(struct amdgpu_device *dev);
 
 drm_private int amdgpu_query_gpu_info_init(amdgpu_device_handle dev);
 
+drm_private int amdgpu_device_cache_load(amdgpu_device_handle dev);
+
+drm_private void amdgpu_device_cache_store(amdgpu_device_handle dev);
+
+drm_private void amdgpu_info_cache_init(amdgpu_device_handle dev);
+
+drm_private void amdgpu_info_cache_fini(amdgpu_device_handle dev);
+
+drm_private void amdgpu_sensor_init(amdgpu_device_handle dev);
+
+drm_private void amdgpu_sensor_fini(amdgpu_device_handle dev);
+
+drm_private uint64_t amdgpu_cs_current_time(void);
+
+drm_private uint64_t amdgpu_cs_coarse_time(void);
+
 drm_private uint64_t amdgpu_cs_calculate_timeout(uint64_t timeout);
 
+drm_private uint64_t amdgpu_cs_stats_start(amdgpu_device_handle dev);
+
+drm_private void amdgpu_cs_stats_request(amdgpu_device_handle dev,
+					 unsigned ip_type, unsigned ip_instance,
+					 uint32_t ring, uint64_t start);
+
+drm_private void amdgpu_cs_stats_submission(amdgpu_device_handle dev,
+					    unsigned ip_type,
+					    unsigned ip_instance,
+					    uint32_t ring, uint64_t start,
+					    uint32_t number_of_ibs,
+					    struct amdgpu_cs_ib_info *ibs,
+					    uint32_t number_of_dependencies);
+
+drm_private void amdgpu_cs_stats_wait(amdgpu_device_handle dev,
+				      unsigned ip_type, unsigned ip_instance,
+				      uint32_t ring, uint64_t start);
+
+drm_private void amdgpu_cs_stats_fini(amdgpu_device_handle dev);
+
+drm_private struct amdgpu_cs_ring *
+amdgpu_cs_create_ring(amdgpu_context_handle context, unsigned ip_type,
+		      unsigned ip_instance, uint32_t ring);
+
+drm_private uint32_t amdgpu_cs_add_dependency(amdgpu_context_handle context,
+					      unsigned ip_type,
+					      unsigned ip_instance,
+					      uint32_t ring,
+					      struct amdgpu_cs_fence *deps,
+					      uint32_t count,
+					      const struct amdgpu_cs_fence *fence);
+
+drm_private int amdgpu_cs_emit(amdgpu_context_handle context,
+			       unsigned ip_type, unsigned ip_instance,
+			       uint32_t ring, uint32_t bo_list_handle,
+			       uint32_t number_of_ibs,
+			       struct amdgpu_cs_ib_info *ibs,
+			       struct amdgpu_cs_fence_info *fence_info,
+			       uint32_t number_of_dependencies,
+			       struct drm_amdgpu_cs_chunk_dep *dependencies,
+			       uint64_t *seq_no);
+
+drm_private void amdgpu_cs_record_user_fence(amdgpu_context_handle context,
+					     unsigned ip_type,
+					     unsigned ip_instance,
+					     uint32_t ring,
+					     struct amdgpu_cs_fence_info *info,
+					     uint64_t seq_no);
+
+drm_private int amdgpu_cs_submit_request(amdgpu_context_handle context,
+					 struct amdgpu_cs_request *ibs_request);
+
+drm_private void amdgpu_cs_implicit_sync_init(amdgpu_device_handle dev);
+
+drm_private void amdgpu_cs_implicit_sync_fini(amdgpu_device_handle dev);
+
+drm_private int amdgpu_cs_implicit_sync_submit(amdgpu_context_handle context,
+					       struct amdgpu_cs_request *ibs_request);
+
+drm_private bool amdgpu_cs_implicit_sync_retire(amdgpu_context_handle context);
+
+drm_private int amdgpu_cs_ctx_destroy(amdgpu_context_handle context);
+
+drm_private void amdgpu_cs_ctx_release(amdgpu_context_handle context);
+
+drm_private void amdgpu_cs_pools_fini(void);
+
+drm_private void amdgpu_cs_sched_init(amdgpu_device_handle dev);
+
+drm_private void amdgpu_cs_sched_fini(amdgpu_device_handle dev);
+
+drm_private int amdgpu_cs_queue_create(amdgpu_context_handle context);
+
+drm_private void amdgpu_cs_queue_destroy(amdgpu_context_handle context);
+
+drm_private void amdgpu_cs_queue_set_coalescing(amdgpu_context_handle context,
+						uint32_t window_us,
+						uint32_t max_ibs);
+
+drm_private int amdgpu_cs_queue_submit(amdgpu_context_handle context,
+				       struct amdgpu_cs_request *ibs_request);
+
+drm_private int amdgpu_cs_fence_to_dep(struct amdgpu_cs_fence *fence,
+				       uint64_t abs_timeout,
+				       struct drm_amdgpu_cs_chunk_dep *dep);
+
+drm_private int amdgpu_cs_queue_translate(struct amdgpu_cs_fence *fence,
+					  uint64_t abs_timeout,
+					  uint64_t *seq_no);
+
 /**
  * Inline functions.
  */
 
+/**
+ * Look up the state of a ring, NULL if the ring is out of range or was
+ * never used by the context.
+ */
+static inline struct amdgpu_cs_ring *
+amdgpu_cs_get_ring(amdgpu_context_handle context, unsigned ip_type,
+		   unsigned ip_instance, uint32_t ring)
+{
+	if (ip_type >= AMDGPU_HW_IP_NUM ||
+	    ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT ||
+	    ring >= AMDGPU_CS_MAX_RINGS)
+		return NULL;
+
+	return context->rings[ip_type][ip_instance][ring];
+}
+
 /**
  * Increment src and decrement dst as if we were updating references
  * for an assignment between 2 pointers of some objects.
@@ -0,0 +1,273 @@
+/**
+ * \file amdgpu_sensor.c
+ *
+ *  Background sensor sampling. One thread per device queries the selected
+ *  sensors periodically and appends the values to a ring of samples per
+ *  sensor. The sampler is the only writer, readers never lock.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+/**
+ * Samples of one sensor. Allocated when the sensor is first sampled and
+ * kept until the device is freed, so readers may access it at any time.
+ */
+struct amdgpu_sensor_ring {
+	/** Samples written so far, accessed atomically. Sample i lives in
+	    slot i % AMDGPU_SENSOR_HISTORY_SIZE and is complete once count
+	    exceeds i. */
+	uint64_t count;
+	struct amdgpu_sensor_sample samples[AMDGPU_SENSOR_HISTORY_SIZE];
+};
+
+struct amdgpu_sensor_sampler {
+	amdgpu_device_handle dev;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool quit;
+	uint64_t period_ns;
+	uint32_t num_sensors;
+	uint32_t sensor_types[AMDGPU_SENSOR_TYPES];
+};
+
+static void amdgpu_sensor_push(struct amdgpu_sensor_ring *ring,
+			       uint64_t time_ns, uint32_t value)
+{
+	uint64_t count = ring->count;
+	struct amdgpu_sensor_sample *sample;
+
+	sample = &ring->samples[count % AMDGPU_SENSOR_HISTORY_SIZE];
+	sample->time_ns = time_ns;
+	sample->value = value;
+	/* readers must see the sample complete before it is counted */
+	memory_write_barrier();
+	atomic_set64((int64 *)&ring->count, count + 1);
+}
+
+static void *amdgpu_sensor_sampler_thread(void *data)
+{
+	struct amdgpu_sensor_sampler *sampler = data;
+	amdgpu_device_handle dev = sampler->dev;
+	uint64_t now, next;
+	struct timespec ts;
+	uint32_t i, value;
+
+	next = amdgpu_cs_current_time();
+
+	pthread_mutex_lock(&sampler->mutex);
+	while (!sampler->quit) {
+		pthread_mutex_unlock(&sampler->mutex);
+
+		for (i = 0; i < sampler->num_sensors; i++) {
+			uint32_t type = sampler->sensor_types[i];
+
+			if (amdgpu_query_sensor_info(dev, type, sizeof(value),
+						     &value))
+				continue;
+			amdgpu_sensor_push(dev->sensor_rings[type],
+					   amdgpu_cs_current_time(), value);
+		}
+
+		/* keep the rate, but don't catch up on missed periods */
+		now = amdgpu_cs_current_time();
+		next += sampler->period_ns;
+		if (next < now)
+			next = now + sampler->period_ns;
+		ts.tv_sec = next / 1000000000ull;
+		ts.tv_nsec = next % 1000000000ull;
+
+		pthread_mutex_lock(&sampler->mutex);
+		while (!sampler->quit &&
+		       pthread_cond_timedwait(&sampler->cond, &sampler->mutex,
+					      &ts) != ETIMEDOUT)
+			;
+	}
+	pthread_mutex_unlock(&sampler->mutex);
+
+	return NULL;
+}
+
+drm_private void amdgpu_sensor_init(amdgpu_device_handle dev)
+{
+	pthread_mutex_init(&dev->sensor_mutex, NULL);
+}
+
+drm_private void amdgpu_sensor_fini(amdgpu_device_handle dev)
+{
+	unsigned i;
+
+	/* nobody else uses the device anymore */
+	if (dev->sensor_sampler)
+		amdgpu_sensor_sampler_stop(dev);
+	for (i = 0; i < AMDGPU_SENSOR_TYPES; i++)
+		free(dev->sensor_rings[i]);
+	pthread_mutex_destroy(&dev->sensor_mutex);
+}
+
+drm_public int amdgpu_sensor_sampler_start(amdgpu_device_handle dev,
+					   uint32_t num_sensors,
+					   const uint32_t *sensor_types,
+					   uint64_t period_ns)
+{
+	struct amdgpu_sensor_sampler *sampler;
+	pthread_condattr_t attr;
+	uint32_t i;
+	int r;
+
+	if (!dev || !num_sensors || !sensor_types || !period_ns ||
+	    num_sensors > AMDGPU_SENSOR_TYPES)
+		return EINVAL;
+
+	for (i = 0; i < num_sensors; i++) {
+		if (!sensor_types[i] || sensor_types[i] >= AMDGPU_SENSOR_TYPES)
+			return EINVAL;
+	}
+
+	pthread_mutex_lock(&dev->sensor_mutex);
+
+	if (dev->sensor_sampler) {
+		r = EBUSY;
+		goto out;
+	}
+
+	for (i = 0; i < num_sensors; i++) {
+		struct amdgpu_sensor_ring *ring;
+
+		if (dev->sensor_rings[sensor_types[i]])
+			continue;
+
+		ring = calloc(1, sizeof(struct amdgpu_sensor_ring));
+		if (!ring) {
+			r = ENOMEM;
+			goto out;
+		}
+		/* lock-free readers must see the ring initialized */
+		memory_write_barrier();
+		dev->sensor_rings[sensor_types[i]] = ring;
+	}
+
+	sampler = calloc(1, sizeof(struct amdgpu_sensor_sampler));
+	if (!sampler) {
+		r = ENOMEM;
+		goto out;
+	}
+
+	sampler->dev = dev;
+	sampler->period_ns = period_ns;
+	sampler->num_sensors = num_sensors;
+	memcpy(sampler->sensor_types, sensor_types,
+	       sizeof(*sensor_types) * num_sensors);
+	pthread_mutex_init(&sampler->mutex, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sampler->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	r = pthread_create(&sampler->thread, NULL, amdgpu_sensor_sampler_thread,
+			   sampler);
+	if (r) {
+		pthread_cond_destroy(&sampler->cond);
+		pthread_mutex_destroy(&sampler->mutex);
+		free(sampler);
+		goto out;
+	}
+
+	dev->sensor_sampler = sampler;
+
+out:
+	pthread_mutex_unlock(&dev->sensor_mutex);
+	return r;
+}
+
+drm_public int amdgpu_sensor_sampler_stop(amdgpu_device_handle dev)
+{
+	struct amdgpu_sensor_sampler *sampler;
+
+	if (!dev)
+		return EINVAL;
+
+	pthread_mutex_lock(&dev->sensor_mutex);
+	sampler = dev->sensor_sampler;
+	dev->sensor_sampler = NULL;
+	pthread_mutex_unlock(&dev->sensor_mutex);
+
+	if (!sampler)
+		return 0;
+
+	pthread_mutex_lock(&sampler->mutex);
+	sampler->quit = true;
+	pthread_cond_signal(&sampler->cond);
+	pthread_mutex_unlock(&sampler->mutex);
+	pthread_join(sampler->thread, NULL);
+
+	pthread_cond_destroy(&sampler->cond);
+	pthread_mutex_destroy(&sampler->mutex);
+	free(sampler);
+	return 0;
+}
+
+drm_public int amdgpu_sensor_read_history(amdgpu_device_handle dev,
+					  uint32_t sensor_type,
+					  uint32_t max_samples,
+					  struct amdgpu_sensor_sample *samples,
+					  uint32_t *num_samples)
+{
+	struct amdgpu_sensor_ring *ring;
+	uint64_t first, count;
+	uint32_t i, n;
+
+	if (!dev || !samples || !num_samples ||
+	    sensor_type >= AMDGPU_SENSOR_TYPES)
+		return EINVAL;
+
+	ring = dev->sensor_rings[sensor_type];
+	if (!ring)
+		return ENOENT;
+	/* pairs with the barrier before the ring is published */
+	memory_read_barrier();
+
+	count = atomic_get64((int64 *)&ring->count);
+	memory_read_barrier();
+
+	n = MIN2(max_samples, AMDGPU_SENSOR_HISTORY_SIZE);
+	if (n > count)
+		n = count;
+	first = count - n;
+	for (i = 0; i < n; i++)
+		samples[i] = ring->samples[(first + i) % AMDGPU_SENSOR_HISTORY_SIZE];
+
+	/* drop the samples the sampler overwrote while they were copied */
+	memory_read_barrier();
+	count = atomic_get64((int64 *)&ring->count);
+	if (count >= AMDGPU_SENSOR_HISTORY_SIZE &&
+	    first <= count - AMDGPU_SENSOR_HISTORY_SIZE) {
+		uint32_t stale = MIN2(count - AMDGPU_SENSOR_HISTORY_SIZE + 1 - first, n);
+
+		memmove(samples, samples + stale, sizeof(*samples) * (n - stale));
+		n -= stale;
+	}
+
+	*num_samples = n;
+	return n ? 0 : ENOENT;
+}
+
+drm_public int amdgpu_sensor_read_latest(amdgpu_device_handle dev,
+					 uint32_t sensor_type,
+					 struct amdgpu_sensor_sample *sample)
+{
+	uint32_t num_samples;
+
+	return amdgpu_sensor_read_history(dev, sensor_type, 1, sample,
+					  &num_samples);
+}
@@ -21,18 +21,72 @@
  *
  */
 
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
 #include "amdgpu.h"
 #include "amdgpu_drm.h"
 #include "xf86drm.h"
 #include "amdgpu_internal.h"
 
+/**
+ * Pass a VM operation on to the accelerant.
+ *
+ * \return  0 on success\n
+ *          ENOSYS if the accelerant has no VM operations\n
+ *          otherwise POSIX Error code
+ */
+static int amdgpu_vm_op(amdgpu_device_handle dev, union drm_amdgpu_vm *vm)
+{
+	if (!dev->acc_amdgpu_vm)
+		return ENOSYS;
+
+	return dev->acc_amdgpu_vm->vt->AmdgpuVm(dev->acc_amdgpu_vm, vm);
+}
+
 drm_public int amdgpu_vm_reserve_vmid(amdgpu_device_handle dev, uint32_t flags)
 {
-	return ENOSYS;
+	union drm_amdgpu_vm vm;
+	int r = 0;
+
+	if (!dev || flags)
+		return EINVAL;
+
+	pthread_mutex_lock(&dev->vmid_mutex);
+	/* the VMID is reserved for the whole VM, only reserve it once */
+	if (!dev->vmid_reservations) {
+		memset(&vm, 0, sizeof(vm));
+		vm.in.op = AMDGPU_VM_OP_RESERVE_VMID;
+		r = amdgpu_vm_op(dev, &vm);
+	}
+	if (!r)
+		dev->vmid_reservations++;
+	pthread_mutex_unlock(&dev->vmid_mutex);
+
+	return r;
 }
 
 drm_public int amdgpu_vm_unreserve_vmid(amdgpu_device_handle dev,
 					uint32_t flags)
 {
-	return ENOSYS;
+	union drm_amdgpu_vm vm;
+	int r = 0;
+
+	if (!dev || flags)
+		return EINVAL;
+
+	pthread_mutex_lock(&dev->vmid_mutex);
+	if (!dev->vmid_reservations) {
+		r = EINVAL;
+	} else if (dev->vmid_reservations == 1) {
+		memset(&vm, 0, sizeof(vm));
+		vm.in.op = AMDGPU_VM_OP_UNRESERVE_VMID;
+		r = amdgpu_vm_op(dev, &vm);
+	}
+	if (!r)
+		dev->vmid_reservations--;
+	pthread_mutex_unlock(&dev->vmid_mutex);
+
+	return r;
 }
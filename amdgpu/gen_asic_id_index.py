@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+# Build the binary index of amdgpu.ids read by amdgpu_asic_id.c.
+#
+# Usage: gen_asic_id_index.py amdgpu.ids amdgpu.ids.idx
+#
+# Layout, all fields native 32-bit words:
+#   magic, version, num_buckets, num_slots
+#   displacement[num_buckets]
+#   slots[num_slots]: key (device_id << 16 | revision_id), name offset
+#   names, NUL terminated
+#
+# A key is found in slot hash(key, displacement[hash(key, 0) % num_buckets])
+# % num_slots. Empty slots have the key 0xffffffff. The layout and hash
+# must match amdgpu_asic_id.c.
+
+import struct
+import sys
+
+MAGIC = 0x58444941  # "AIDX"
+VERSION = 1
+EMPTY = 0xffffffff
+MASK = 0xffffffff
+
+
+def asic_id_hash(key, seed):
+    h = (key ^ seed) & MASK
+    h ^= h >> 16
+    h = (h * 0x7feb352d) & MASK
+    h ^= h >> 15
+    h = (h * 0x846ca68b) & MASK
+    h ^= h >> 16
+    return h
+
+
+def parse(path):
+    ids = {}
+    version_seen = False
+    with open(path, encoding='utf-8') as f:
+        for num, line in enumerate(f, 1):
+            line = line.rstrip('\n')
+            if not line or line.startswith('#'):
+                continue
+            # 1st valid line is file version
+            if not version_seen:
+                version_seen = True
+                continue
+            fields = line.split(',', 2)
+            if len(fields) != 3 or not fields[2].strip():
+                sys.exit('%s:%d: invalid format: %s' % (path, num, line))
+            key = int(fields[0], 16) << 16 | int(fields[1], 16)
+            # the first entry wins, like when parsing the text
+            ids.setdefault(key, fields[2].lstrip(' \t'))
+    return ids
+
+
+def build(ids):
+    num_slots = max(len(ids), 1)
+    num_buckets = max(num_slots // 4, 1)
+
+    buckets = [[] for _ in range(num_buckets)]
+    for key in ids:
+        buckets[asic_id_hash(key, 0) % num_buckets].append(key)
+
+    displacement = [0] * num_buckets
+    slots = [None] * num_slots
+    # place the largest buckets first while there is room to choose
+    for b in sorted(range(num_buckets), key=lambda b: -len(buckets[b])):
+        if not buckets[b]:
+            break
+        d = 1
+        while True:
+            pos = [asic_id_hash(key, d) % num_slots for key in buckets[b]]
+            if len(set(pos)) == len(pos) and all(slots[p] is None for p in pos):
+                break
+            d += 1
+        displacement[b] = d
+        for key, p in zip(buckets[b], pos):
+            slots[p] = key
+    return num_buckets, displacement, slots
+
+
+def main():
+    ids = parse(sys.argv[1])
+    num_buckets, displacement, slots = build(ids)
+
+    names = b''
+    offsets = {}
+    for key in sorted(ids):
+        offsets[key] = len(names)
+        names += ids[key].encode('utf-8') + b'\0'
+
+    out = struct.pack('=4I', MAGIC, VERSION, num_buckets, len(slots))
+    out += struct.pack('=%dI' % num_buckets, *displacement)
+    for key in slots:
+        if key is None:
+            out += struct.pack('=2I', EMPTY, 0)
+        else:
+            out += struct.pack('=2I', key, offsets[key])
+    out += names
+
+    with open(sys.argv[2], 'wb') as f:
+        f.write(out)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,33 @@
+#!/usr/bin/env python3
+# Build the table of amdgpu.ids compiled into amdgpu_asic_id.c.
+#
+# Usage: gen_asic_id_table.py amdgpu.ids amdgpu_asic_id_table.h
+#
+# The entries are sorted by key (device_id << 16 | revision_id) for a
+# binary search. Duplicate keys are resolved like in the binary index.
+
+import sys
+
+sys.dont_write_bytecode = True
+from gen_asic_id_index import parse
+
+
+def c_string(s):
+    return '"%s"' % s.replace('\\', '\\\\').replace('"', '\\"')
+
+
+def main():
+    ids = parse(sys.argv[1])
+
+    out = '/* Generated by gen_asic_id_table.py from amdgpu.ids, do not edit. */\n\n'
+    out += 'static const struct amdgpu_asic_id amdgpu_asic_id_table[] = {\n'
+    for key in sorted(ids):
+        out += '\t{ 0x%08x, %s },\n' % (key, c_string(ids[key]))
+    out += '};\n'
+
+    with open(sys.argv[2], 'w', encoding='utf-8') as f:
+        f.write(out)
+
+
+if __name__ == '__main__':
+    main()
@@ -11,6 +11,7 @@
 #include <stdlib.h>
 
 #include <algorithm>
+#include <vector>
 
 #include <Entry.h>
 #include <Directory.h>
@@ -22,7 +23,7 @@
 static const char sDevPath[] = "/dev/graphics/";
 
 
-static bool ParseDevPciAdr(uint8 &bus, uint8 &device, uint8 function, const char *name)
+static bool ParseDevPciAdr(uint8 &bus, uint8 &device, uint8 &function, const char *name)
 {
 	size_t nameLen = strlen(name);
 	if (nameLen <= 7 || name[nameLen - 7] != '_') return false;
@@ -40,17 +41,45 @@ static bool ParseDevPciAdr(uint8 &bus, uint8 &device, uint8 function, const char
 	return true;
 }
 
-static status_t LookupPciDevice(pci_info &info, uint8 bus, uint8 device, uint8 function)
-{
-	uint32 index = 0;
-	for (;;) {
-		status_t res = gPoke.GetNthPciInfo(index, info);
-		if (res < B_OK) return res;
-		if (info.bus == bus && info.device == device && info.function == function) return B_OK;
-		index++;
+// PCI devices enumerated at most once for all nodes of an enumeration.
+// Enumerating the bus costs one ioctl per PCI device, so it only goes as
+// far as the lookups need.
+class PciSnapshot {
+private:
+	std::vector<pci_info> fInfos;
+	uint32 fNextIndex = 0;
+	bool fComplete = false;
+
+	static bool Matches(const pci_info &info, uint8 bus, uint8 device, uint8 function)
+	{
+		return info.bus == bus && info.device == device && info.function == function;
 	}
-}
 
+public:
+	status_t Lookup(pci_info &info, uint8 bus, uint8 device, uint8 function)
+	{
+		for (const pci_info &known : fInfos) {
+			if (Matches(known, bus, device, function)) {
+				info = known;
+				return B_OK;
+			}
+		}
+		while (!fComplete) {
+			pci_info next {};
+			if (gPoke.GetNthPciInfo(fNextIndex, next) < B_OK) {
+				fComplete = true;
+				break;
+			}
+			fNextIndex++;
+			fInfos.push_back(next);
+			if (Matches(next, bus, device, function)) {
+				info = next;
+				return B_OK;
+			}
+		}
+		return ENOENT;
+	}
+};
 
 // #pragma mark -
 
@@ -108,14 +137,14 @@ static drmDevicePtr drmDeviceAlloc(unsigned int type, const char *node, size_t b
     return device;
 }
 
-static int drmGetDeviceInt(drmDevicePtr *device, const char *name)
+static int drmGetDeviceInt(drmDevicePtr *device, const char *name, PciSnapshot &pci)
 {
 	*device = NULL;
 
 	pci_info info {};
 	if (!ParseDevPciAdr(info.bus, info.device, info.function, name)) return ENOENT;
 
-	status_t res = LookupPciDevice(info, info.bus, info.device, info.function);
+	status_t res = pci.Lookup(info, info.bus, info.device, info.function);
 	if (res < B_OK) return res;
 
 	char path[MAXPATHLEN];
@@ -144,6 +173,7 @@ drm_public int drmGetDevices2(uint32_t flags, drmDevicePtr devices[], int max_de
 {
 	fprintf(stderr, "drmGetDevices2()\n");
 
+	PciSnapshot pci;
 	BDirectory dir(sDevPath);
 	dir.Rewind();
 	int deviceCnt;
@@ -151,7 +181,7 @@ drm_public int drmGetDevices2(uint32_t flags, drmDevicePtr devices[], int max_de
 		BEntry entry;
 		if (dir.GetNextEntry(&entry, true) < B_OK) break;
 		if (devices != NULL) {
-			drmGetDeviceInt(&devices[deviceCnt], entry.Name());
+			drmGetDeviceInt(&devices[deviceCnt], entry.Name(), pci);
 			if (devices[deviceCnt] != NULL) deviceCnt++;
 		}
 	}
@@ -239,7 +269,8 @@ drm_public int drmGetDevice2(int fd, uint32_t flags, drmDevicePtr *device)
 		struct stat st2 {};
 		if (entry.GetStat(&st2) < B_OK) return B_ERROR;
 		if (st.st_dev == st2.st_dev && st.st_ino == st2.st_ino) {
-			drmGetDeviceInt(device, entry.Name());
+			PciSnapshot pci;
+			drmGetDeviceInt(device, entry.Name(), pci);
 			return 0;
 		}
 	}
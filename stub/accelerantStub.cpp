@@ -0,0 +1,239 @@
+#include "accelerantStub.h"
+
+extern "C" {
+#include <xf86drm.h>
+#include <libdrm/amdgpu_drm.h>
+#include "amdgpu.h"
+}
+#include <alloca.h>
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <AccelerantDrm.h>
+#include <AccelerantAmdgpu.h>
+#include "AccelerantAmdgpuVm.h"
+
+#include "libdrmStub.h"
+
+#define memclear(s) memset(&s, 0, sizeof(s))
+
+
+struct AccelerantStub {
+	accelerant_base base;
+	accelerant_drm drm;
+	accelerant_amdgpu amdgpu;
+	accelerant_amdgpu_vm amdgpuVm;
+	accelerant_base_vt baseVt;
+	accelerant_drm_vt drmVt;
+	accelerant_amdgpu_vt amdgpuVt;
+	accelerant_amdgpu_vm_vt amdgpuVmVt;
+	int32 refCount;
+	int fd;
+};
+
+#define STUB_FROM(iface, member) \
+	((AccelerantStub*)((char*)(iface) - offsetof(AccelerantStub, member)))
+
+
+static int StubIoctl(int fd, unsigned long request, void *arg)
+{
+	return drmIoctlStub(fd, request, arg) != 0 ? EINVAL : 0;
+}
+
+
+// #pragma mark - base
+
+static void StubAcquireReference(accelerant_base *acc)
+{
+	atomic_add(&STUB_FROM(acc, base)->refCount, 1);
+}
+
+static void StubReleaseReference(accelerant_base *acc)
+{
+	AccelerantStub *stub = STUB_FROM(acc, base);
+	if (atomic_add(&stub->refCount, -1) == 1)
+		free(stub);
+}
+
+static void *StubQueryInterface(accelerant_base *acc, const char *name)
+{
+	AccelerantStub *stub = STUB_FROM(acc, base);
+	if (strcmp(name, B_ACCELERANT_IFACE_DRM) == 0)
+		return &stub->drm;
+	if (strcmp(name, B_ACCELERANT_IFACE_AMDGPU) == 0)
+		return &stub->amdgpu;
+	if (strcmp(name, B_ACCELERANT_IFACE_AMDGPU_VM) == 0)
+		return &stub->amdgpuVm;
+	return NULL;
+}
+
+
+// #pragma mark - drm
+
+static int StubDrmVersion(accelerant_drm *acc, struct drm_version *version)
+{
+	return StubIoctl(STUB_FROM(acc, drm)->fd, DRM_IOCTL_VERSION, version);
+}
+
+static int StubDrmCloseBufferHandle(accelerant_drm *acc, uint32_t handle)
+{
+	struct drm_gem_close args;
+	memclear(args);
+	args.handle = handle;
+	return StubIoctl(STUB_FROM(acc, drm)->fd, DRM_IOCTL_GEM_CLOSE, &args);
+}
+
+static int StubDrmSyncobjCreate(accelerant_drm *acc, uint32_t flags, uint32_t *handle)
+{
+	struct drm_syncobj_create args;
+	memclear(args);
+	args.flags = flags;
+	int ret = StubIoctl(STUB_FROM(acc, drm)->fd, DRM_IOCTL_SYNCOBJ_CREATE, &args);
+	if (ret == 0)
+		*handle = args.handle;
+	return ret;
+}
+
+static int StubDrmSyncobjDestroy(accelerant_drm *acc, uint32_t handle)
+{
+	struct drm_syncobj_destroy args;
+	memclear(args);
+	args.handle = handle;
+	return StubIoctl(STUB_FROM(acc, drm)->fd, DRM_IOCTL_SYNCOBJ_DESTROY, &args);
+}
+
+
+// #pragma mark - amdgpu
+
+static int StubAmdgpuQueryInfo(accelerant_amdgpu *acc, struct drm_amdgpu_info *info)
+{
+	return StubIoctl(STUB_FROM(acc, amdgpu)->fd, DRM_IOCTL_AMDGPU_INFO, info);
+}
+
+static int StubAmdgpuCtxRaw(accelerant_amdgpu *acc, union drm_amdgpu_ctx *args)
+{
+	return StubIoctl(STUB_FROM(acc, amdgpu)->fd, DRM_IOCTL_AMDGPU_CTX, args);
+}
+
+static int StubAmdgpuBoAlloc(accelerant_amdgpu *acc, struct amdgpu_bo_alloc_request *request, uint32_t *handle)
+{
+	union drm_amdgpu_gem_create args;
+	memclear(args);
+	args.in.bo_size = request->alloc_size;
+	args.in.alignment = request->phys_alignment;
+	args.in.domains = request->preferred_heap;
+	args.in.domain_flags = request->flags;
+	int ret = StubIoctl(STUB_FROM(acc, amdgpu)->fd, DRM_IOCTL_AMDGPU_GEM_CREATE, &args);
+	if (ret == 0)
+		*handle = args.out.handle;
+	return ret;
+}
+
+static int StubAmdgpuBoCpuMap(accelerant_amdgpu *acc, uint32_t handle, void **ptr)
+{
+	AccelerantStub *stub = STUB_FROM(acc, amdgpu);
+	union drm_amdgpu_gem_mmap args;
+	memclear(args);
+	args.in.handle = handle;
+	int ret = StubIoctl(stub->fd, DRM_IOCTL_AMDGPU_GEM_MMAP, &args);
+	if (ret != 0)
+		return ret;
+	*ptr = drmMmapStub(NULL, 0, 0, 0, stub->fd, args.out.addr_ptr);
+	return *ptr != NULL ? 0 : ENOMEM;
+}
+
+static int StubAmdgpuBoVaOpRaw(accelerant_amdgpu *acc, uint32_t handle, uint64_t offset, uint64_t size, uint64_t addr, uint64_t flags, uint32_t ops)
+{
+	struct drm_amdgpu_gem_va args;
+	memclear(args);
+	args.handle = handle;
+	args.operation = ops;
+	args.flags = flags;
+	args.va_address = addr;
+	args.offset_in_bo = offset;
+	args.map_size = size;
+	return StubIoctl(STUB_FROM(acc, amdgpu)->fd, DRM_IOCTL_AMDGPU_GEM_VA, &args);
+}
+
+static int StubAmdgpuCsSubmitRaw(accelerant_amdgpu *acc, uint32_t ctxId, uint32_t boListHandle, int numChunks, struct drm_amdgpu_cs_chunk *chunks, uint64_t *seqNo)
+{
+	struct drm_amdgpu_cs_chunk **chunkArray = (struct drm_amdgpu_cs_chunk**)alloca(sizeof(*chunkArray) * numChunks);
+	for (int i = 0; i < numChunks; i++)
+		chunkArray[i] = &chunks[i];
+
+	union drm_amdgpu_cs args;
+	memclear(args);
+	args.in.ctx_id = ctxId;
+	args.in.bo_list_handle = boListHandle;
+	args.in.num_chunks = numChunks;
+	args.in.chunks = (uint64_t)(uintptr_t)chunkArray;
+	int ret = StubIoctl(STUB_FROM(acc, amdgpu)->fd, DRM_IOCTL_AMDGPU_CS, &args);
+	if (ret == 0)
+		*seqNo = args.out.handle;
+	return ret;
+}
+
+static int StubAmdgpuWaitCs(accelerant_amdgpu *acc, uint32_t ctxId, unsigned ip, unsigned ipInstance, uint32_t ring, uint64_t handle, uint64_t timeout, bool *busy)
+{
+	union drm_amdgpu_wait_cs args;
+	memclear(args);
+	args.in.handle = handle;
+	args.in.timeout = timeout;
+	args.in.ip_type = ip;
+	args.in.ip_instance = ipInstance;
+	args.in.ring = ring;
+	args.in.ctx_id = ctxId;
+	int ret = StubIoctl(STUB_FROM(acc, amdgpu)->fd, DRM_IOCTL_AMDGPU_WAIT_CS, &args);
+	if (ret == 0)
+		*busy = args.out.status != 0;
+	return ret;
+}
+
+
+// #pragma mark - amdgpu_vm
+
+static int StubAmdgpuVm(accelerant_amdgpu_vm *acc, union drm_amdgpu_vm *args)
+{
+	return StubIoctl(STUB_FROM(acc, amdgpuVm)->fd, DRM_IOCTL_AMDGPU_VM, args);
+}
+
+
+// #pragma mark -
+
+accelerant_base *CreateAccelerantStub(int fd)
+{
+	AccelerantStub *stub = (AccelerantStub*)calloc(1, sizeof(AccelerantStub));
+	if (stub == NULL)
+		return NULL;
+
+	stub->refCount = 1;
+	stub->fd = fd;
+
+	stub->baseVt.AcquireReference = StubAcquireReference;
+	stub->baseVt.ReleaseReference = StubReleaseReference;
+	stub->baseVt.QueryInterface = StubQueryInterface;
+	stub->base.vt = &stub->baseVt;
+
+	// interfaces the library doesn't use in tests stay NULL
+	stub->drmVt.DrmVersion = StubDrmVersion;
+	stub->drmVt.DrmCloseBufferHandle = StubDrmCloseBufferHandle;
+	stub->drmVt.DrmSyncobjCreate = StubDrmSyncobjCreate;
+	stub->drmVt.DrmSyncobjDestroy = StubDrmSyncobjDestroy;
+	stub->drm.vt = &stub->drmVt;
+
+	stub->amdgpuVt.AmdgpuQueryInfo = StubAmdgpuQueryInfo;
+	stub->amdgpuVt.AmdgpuCtxRaw = StubAmdgpuCtxRaw;
+	stub->amdgpuVt.AmdgpuBoAlloc = StubAmdgpuBoAlloc;
+	stub->amdgpuVt.AmdgpuBoCpuMap = StubAmdgpuBoCpuMap;
+	stub->amdgpuVt.AmdgpuBoVaOpRaw = StubAmdgpuBoVaOpRaw;
+	stub->amdgpuVt.AmdgpuCsSubmitRaw = StubAmdgpuCsSubmitRaw;
+	stub->amdgpuVt.AmdgpuWaitCs = StubAmdgpuWaitCs;
+	stub->amdgpu.vt = &stub->amdgpuVt;
+
+	stub->amdgpuVmVt.AmdgpuVm = StubAmdgpuVm;
+	stub->amdgpuVm.vt = &stub->amdgpuVmVt;
+
+	return &stub->base;
+}
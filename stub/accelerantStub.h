@@ -0,0 +1,9 @@
+#pragma once
+
+#include <AccelerantRoster.h>
+
+// Accelerant with the interfaces libdrm_amdgpu uses, answered by the
+// libdrm stub like the ioctls of the same name. Requests are made with
+// fd, so separate fds act as separate DRM files of the same GPU.
+// Released with ReleaseReference().
+accelerant_base *CreateAccelerantStub(int fd);
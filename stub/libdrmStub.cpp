@@ -12,6 +12,7 @@ extern "C" {
 #include <string.h>
 #include <stdlib.h>
 #include <dlfcn.h>
+#include <pthread.h>
 
 #include <SupportDefs.h>
 #include <OS.h>
@@ -26,9 +27,130 @@ extern "C" {
 #include "memory.h"
 #include "fdMapper.h"
 
+#include <private/shared/PthreadMutexLocker.h>
+
 #define memclear(s) memset(&s, 0, sizeof(s))
 
 
+// VMIDs of the emulated GPU, VMID 0 belongs to the kernel. Each DRM file
+// has its own VM.
+#define STUB_VMIDS 3
+
+struct StubVmid {
+	int vm;			// fd of the VM that used it last, -1 if none
+	bool reserved;
+	uint64 lastUse;
+};
+
+static pthread_mutex_t sStubLock = PTHREAD_MUTEX_INITIALIZER;
+static DrmStubStats sStats;
+static uint32_t sBlockedCtx;
+static pthread_cond_t sBlockedCtxCond = PTHREAD_COND_INITIALIZER;
+static StubVmid sVmids[STUB_VMIDS] = {{-1}, {-1}, {-1}};
+static uint64 sVmidClock;
+static int32 sLastVmid;
+
+
+// #pragma mark - statistics
+
+void drmStubGetStats(DrmStubStats &stats)
+{
+	PthreadMutexLocker lock(&sStubLock);
+	stats = sStats;
+}
+
+void drmStubResetStats()
+{
+	PthreadMutexLocker lock(&sStubLock);
+	memclear(sStats);
+}
+
+// DRM_AMDGPU_CS of context ctx waits until another one, or 0 for none, is
+// set. The submission is only recorded once it passes.
+void drmStubSetBlockedContext(uint32_t ctx)
+{
+	PthreadMutexLocker lock(&sStubLock);
+	sBlockedCtx = ctx;
+	pthread_cond_broadcast(&sBlockedCtxCond);
+}
+
+
+// #pragma mark - VMIDs
+
+// Called with sStubLock held
+static void StubVmidAssign(int32 vmid, int fd)
+{
+	// the VMID still has the page tables of another VM cached
+	if (sVmids[vmid].vm >= 0 && sVmids[vmid].vm != fd)
+		sStats.vmidFlushes++;
+	sVmids[vmid].vm = fd;
+}
+
+// Pick the VMID of a submission like the kernel: the reserved one of the
+// VM, the one the VM used last if nobody took it since, or the least
+// recently used one that isn't reserved.
+// Called with sStubLock held
+static void StubVmidGrab(int fd)
+{
+	int32 vmid = -1, lru = -1;
+	for (int32 i = 1; i < STUB_VMIDS; i++) {
+		if (sVmids[i].vm == fd) {
+			vmid = i;
+			break;
+		}
+		if (!sVmids[i].reserved && (lru < 0 || sVmids[i].lastUse < sVmids[lru].lastUse))
+			lru = i;
+	}
+	if (vmid < 0) {
+		vmid = lru;
+		StubVmidAssign(vmid, fd);
+	}
+	sVmids[vmid].lastUse = ++sVmidClock;
+
+	if (vmid != sLastVmid) {
+		sStats.vmidSwitches++;
+		sLastVmid = vmid;
+	}
+}
+
+// Called with sStubLock held
+static int StubVmidReserve(int fd)
+{
+	int32 vmid = -1, unreserved = 0;
+	for (int32 i = 1; i < STUB_VMIDS; i++) {
+		if (sVmids[i].reserved) {
+			if (sVmids[i].vm == fd)
+				return 0;
+			continue;
+		}
+		unreserved++;
+		// prefer the VMID the VM has, it needs no flush
+		if (vmid < 0 || sVmids[i].vm == fd
+			|| (sVmids[vmid].vm != fd && sVmids[i].lastUse < sVmids[vmid].lastUse))
+			vmid = i;
+	}
+	// keep one VMID for the VMs without a reservation
+	if (unreserved < 2)
+		return -1;
+
+	StubVmidAssign(vmid, fd);
+	sVmids[vmid].reserved = true;
+	return 0;
+}
+
+// Called with sStubLock held
+static int StubVmidUnreserve(int fd)
+{
+	for (int32 i = 1; i < STUB_VMIDS; i++) {
+		if (sVmids[i].reserved && sVmids[i].vm == fd) {
+			sVmids[i].reserved = false;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+
 // #pragma mark - ioctl interface
 
 void *drmMmapStub(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
@@ -466,8 +588,10 @@ static int HandleAmdgpuIoctl(int fd, unsigned long request, void *arg)
 			union drm_amdgpu_ctx *request = (union drm_amdgpu_ctx*)arg;
 			switch (request->in.op) {
 				case AMDGPU_CTX_OP_ALLOC_CTX: {
-					static uint32_t newCtx = 1;
-					request->out.alloc.ctx_id = newCtx++;
+					static int32 newCtx = 1;
+					request->out.alloc.ctx_id = atomic_add(&newCtx, 1);
+					PthreadMutexLocker lock(&sStubLock);
+					sStats.lastCtx = request->out.alloc.ctx_id;
 					return 0;
 				}
 				case AMDGPU_CTX_OP_FREE_CTX: {
@@ -518,6 +642,7 @@ static int HandleAmdgpuIoctl(int fd, unsigned long request, void *arg)
 		case DRM_AMDGPU_CS: {
 			auto args = (union drm_amdgpu_cs*)arg;
 			auto chunks = (struct drm_amdgpu_cs_chunk**)args->in.chunks;
+			uint64_t dependency = 0;
 			for (size_t i = 0; i < args->in.num_chunks; i++) {
 				switch(chunks[i]->chunk_id) {
 					case AMDGPU_CHUNK_ID_IB: {
@@ -539,6 +664,9 @@ static int HandleAmdgpuIoctl(int fd, unsigned long request, void *arg)
 						break;
 					}
 					case AMDGPU_CHUNK_ID_DEPENDENCIES: {
+						auto deps = (struct drm_amdgpu_cs_chunk_dep*)chunks[i]->chunk_data;
+						if (dependency == 0 && chunks[i]->length_dw >= sizeof(*deps) / 4)
+							dependency = deps[0].handle;
 						break;
 					}
 					case AMDGPU_CHUNK_ID_BO_HANDLES: {
@@ -547,10 +675,38 @@ static int HandleAmdgpuIoctl(int fd, unsigned long request, void *arg)
 					}
 				}
 			}
-			static uint64 handle = 1;
-			args->out.handle = handle++;
+			static int64 handle = 1;
+			PthreadMutexLocker lock(&sStubLock);
+			while (args->in.ctx_id == sBlockedCtx)
+				pthread_cond_wait(&sBlockedCtxCond, &sStubLock);
+			args->out.handle = atomic_add64(&handle, 1);
+			if (sStats.submissionCount < DRM_STUB_MAX_SUBMISSIONS) {
+				sStats.submissionCtx[sStats.submissionCount] = args->in.ctx_id;
+				sStats.submissionTime[sStats.submissionCount] = system_time();
+				sStats.submissionHandle[sStats.submissionCount] = args->out.handle;
+				sStats.submissionDependency[sStats.submissionCount] = dependency;
+			}
+			sStats.submissionCount++;
+			StubVmidGrab(fd);
 			return 0;
 		}
+		case DRM_AMDGPU_VM: {
+			union drm_amdgpu_vm *args = (union drm_amdgpu_vm*)arg;
+			if (args->in.flags != 0)
+				return -1;
+			switch (args->in.op) {
+				case AMDGPU_VM_OP_RESERVE_VMID: {
+					PthreadMutexLocker lock(&sStubLock);
+					return StubVmidReserve(fd);
+				}
+				case AMDGPU_VM_OP_UNRESERVE_VMID: {
+					PthreadMutexLocker lock(&sStubLock);
+					return StubVmidUnreserve(fd);
+				}
+				default:
+					return -1;
+			}
+		}
 		case DRM_AMDGPU_WAIT_CS: {
 			union drm_amdgpu_wait_cs *args = (union drm_amdgpu_wait_cs*)arg;
 			// printf("[WAIT]"); fgetc(stdin);
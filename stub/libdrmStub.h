@@ -3,7 +3,34 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <SupportDefs.h>
+#include <OS.h>
+
+#define DRM_STUB_MAX_SUBMISSIONS 256
+
+// What the emulated kernel saw, for tests
+struct DrmStubStats {
+	// id of the last context allocated
+	uint32_t lastCtx;
+	// context of each DRM_AMDGPU_CS in the order of the calls, only the
+	// first DRM_STUB_MAX_SUBMISSIONS are recorded
+	uint32_t submissionCtx[DRM_STUB_MAX_SUBMISSIONS];
+	// system_time() of each of them
+	bigtime_t submissionTime[DRM_STUB_MAX_SUBMISSIONS];
+	// sequence number returned for each of them
+	uint64_t submissionHandle[DRM_STUB_MAX_SUBMISSIONS];
+	// sequence number of the first dependency of each of them, 0 if none
+	uint64_t submissionDependency[DRM_STUB_MAX_SUBMISSIONS];
+	uint32_t submissionCount;
+	// submissions that ran with another VMID than the one before
+	uint32_t vmidSwitches;
+	// VMIDs that were taken over from another VM, which flushes them
+	uint32_t vmidFlushes;
+};
 
 void *drmMmapStub(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
 int drmMunmapStub(void *addr, size_t length);
 int drmIoctlStub(int fd, unsigned long request, void *arg);
+
+void drmStubGetStats(DrmStubStats &stats);
+void drmStubResetStats();
+void drmStubSetBlockedContext(uint32_t ctx);
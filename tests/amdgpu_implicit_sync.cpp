@@ -0,0 +1,135 @@
+/*
+ * Checks that an asynchronous context with implicit sync can be freed
+ * while its work is still queued, and that later submissions depending on
+ * that work get the sequence number the kernel assigned to it, not the one
+ * the library handed out.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+extern "C" {
+#include <libdrm/amdgpu_drm.h>
+#include "amdgpu.h"
+}
+
+#include "accelerantStub.h"
+#include "libdrmStub.h"
+
+#define CheckRet(expr) {int _err = (expr); if (_err != 0) {fprintf(stderr, "%s failed: %d\n", #expr, _err); return 1;}}
+
+// submissions that make the kernel numbering run ahead of the library one
+#define WARMUP_COUNT	4
+
+
+static int Submit(amdgpu_context_handle ctx, amdgpu_bo_list_handle list, struct amdgpu_cs_fence *fence)
+{
+	struct amdgpu_cs_ib_info ib;
+	memset(&ib, 0, sizeof(ib));
+	ib.ib_mc_address = 0x100000;
+	ib.size = 16;
+
+	struct amdgpu_cs_request request;
+	memset(&request, 0, sizeof(request));
+	request.ip_type = AMDGPU_HW_IP_GFX;
+	request.resources = list;
+	request.number_of_ibs = 1;
+	request.ibs = &ib;
+
+	int ret = amdgpu_cs_submit(ctx, 0, &request, 1);
+	if (ret != 0)
+		return ret;
+
+	memset(fence, 0, sizeof(*fence));
+	fence->context = ctx;
+	fence->ip_type = AMDGPU_HW_IP_GFX;
+	fence->fence = request.seq_no;
+	return 0;
+}
+
+static int CreateContext(amdgpu_device_handle dev, amdgpu_context_handle *ctx, uint32_t *ctxId)
+{
+	CheckRet(amdgpu_cs_ctx_create(dev, ctx));
+	DrmStubStats stats;
+	drmStubGetStats(stats);
+	*ctxId = stats.lastCtx;
+
+	CheckRet(amdgpu_cs_ctx_set_async_submit(*ctx, true));
+	CheckRet(amdgpu_cs_ctx_set_implicit_sync(*ctx, true));
+	return 0;
+}
+
+int main()
+{
+	accelerant_base *acc = CreateAccelerantStub(3);
+	if (acc == NULL)
+		return 1;
+
+	amdgpu_device_handle dev;
+	uint32_t major, minor;
+	int ret = amdgpu_device_initialize_haiku(acc, &major, &minor, &dev);
+	acc->vt->ReleaseReference(acc);
+	CheckRet(ret);
+
+	struct amdgpu_bo_alloc_request alloc;
+	memset(&alloc, 0, sizeof(alloc));
+	alloc.alloc_size = 4096;
+	alloc.phys_alignment = 4096;
+	alloc.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+	amdgpu_bo_handle bo;
+	CheckRet(amdgpu_bo_alloc(dev, &alloc, &bo));
+	amdgpu_bo_list_handle list;
+	CheckRet(amdgpu_bo_list_create(dev, 1, &bo, NULL, &list));
+
+	amdgpu_context_handle warmup;
+	CheckRet(amdgpu_cs_ctx_create(dev, &warmup));
+	struct amdgpu_cs_fence fence;
+	for (int i = 0; i < WARMUP_COUNT; i++)
+		CheckRet(Submit(warmup, NULL, &fence));
+	CheckRet(amdgpu_cs_ctx_free(warmup));
+
+	amdgpu_context_handle writer, reader;
+	uint32_t writerId, readerId;
+	CheckRet(CreateContext(dev, &writer, &writerId));
+	CheckRet(CreateContext(dev, &reader, &readerId));
+
+	drmStubResetStats();
+	drmStubSetBlockedContext(writerId);
+
+	struct amdgpu_cs_fence writerFence, readerFence;
+	CheckRet(Submit(writer, list, &writerFence));
+	// doesn't wait for the write, the context is kept until it completed
+	CheckRet(amdgpu_cs_ctx_free(writer));
+	CheckRet(Submit(reader, list, &readerFence));
+
+	drmStubSetBlockedContext(0);
+
+	uint32_t expired;
+	CheckRet(amdgpu_cs_query_fence_status(&readerFence, AMDGPU_TIMEOUT_INFINITE, 0, &expired));
+
+	DrmStubStats stats;
+	drmStubGetStats(stats);
+	uint64_t writerHandle = 0, readerDependency = 0;
+	for (uint32_t i = 0; i < stats.submissionCount; i++) {
+		if (stats.submissionCtx[i] == writerId)
+			writerHandle = stats.submissionHandle[i];
+		else if (stats.submissionCtx[i] == readerId)
+			readerDependency = stats.submissionDependency[i];
+	}
+	if (writerHandle == 0 || writerHandle == writerFence.fence) {
+		fprintf(stderr, "write submitted as %" B_PRIu64 ", library sequence number %" B_PRIu64 "\n",
+			writerHandle, writerFence.fence);
+		return 1;
+	}
+	if (readerDependency != writerHandle) {
+		fprintf(stderr, "read depends on %" B_PRIu64 ", expected %" B_PRIu64 "\n",
+			readerDependency, writerHandle);
+		return 1;
+	}
+
+	CheckRet(amdgpu_cs_ctx_free(reader));
+	CheckRet(amdgpu_bo_list_destroy(list));
+	CheckRet(amdgpu_bo_free(bo));
+	CheckRet(amdgpu_device_deinitialize(dev));
+	return 0;
+}
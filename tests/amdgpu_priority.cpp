@@ -0,0 +1,161 @@
+/*
+ * Checks that the workers of asynchronous contexts hold back a backlog of
+ * low priority submissions while a context of higher priority has
+ * requests queued. The high priority submissions are kept queued by the
+ * stub, so the check doesn't depend on how the threads are scheduled:
+ * every low priority submission must wait the whole hold-back, and must
+ * still go through.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <OS.h>
+
+extern "C" {
+#include <libdrm/amdgpu_drm.h>
+#include "amdgpu.h"
+}
+
+#include "accelerantStub.h"
+#include "libdrmStub.h"
+
+#define CheckRet(expr) {int _err = (expr); if (_err != 0) {fprintf(stderr, "%s failed: %d\n", #expr, _err); return 1;}}
+
+#define LOW_COUNT	16
+#define HIGH_COUNT	4
+// low priority submissions that have to pass while the high priority ones
+// are blocked
+#define LOW_HELD_BACK	2
+// AMDGPU_CS_PRIORITY_YIELD_NS
+#define HOLD_BACK	2000
+#define WAIT_LIMIT	1000000
+
+
+static int Submit(amdgpu_context_handle ctx, struct amdgpu_cs_fence *fence)
+{
+	struct amdgpu_cs_ib_info ib;
+	memset(&ib, 0, sizeof(ib));
+	ib.ib_mc_address = 0x100000;
+	ib.size = 16;
+
+	struct amdgpu_cs_request request;
+	memset(&request, 0, sizeof(request));
+	request.ip_type = AMDGPU_HW_IP_GFX;
+	request.number_of_ibs = 1;
+	request.ibs = &ib;
+
+	int ret = amdgpu_cs_submit(ctx, 0, &request, 1);
+	if (ret != 0)
+		return ret;
+
+	memset(fence, 0, sizeof(*fence));
+	fence->context = ctx;
+	fence->ip_type = AMDGPU_HW_IP_GFX;
+	fence->fence = request.seq_no;
+	return 0;
+}
+
+static int CreateContext(amdgpu_device_handle dev, uint32_t priority, amdgpu_context_handle *ctx, uint32_t *ctxId)
+{
+	CheckRet(amdgpu_cs_ctx_create2(dev, priority, ctx));
+	DrmStubStats stats;
+	drmStubGetStats(stats);
+	*ctxId = stats.lastCtx;
+
+	CheckRet(amdgpu_cs_ctx_set_async_submit(*ctx, true));
+	// one request per submission
+	CheckRet(amdgpu_cs_ctx_set_coalescing(*ctx, 0, 1));
+	return 0;
+}
+
+// Waits without making the worker skip holding back its next batch, only
+// a blocking wait asks for that
+static int WaitIdle(struct amdgpu_cs_fence *fence)
+{
+	for (;;) {
+		uint32_t expired;
+		CheckRet(amdgpu_cs_query_fence_status(fence, 0, 0, &expired));
+		if (expired)
+			return 0;
+		snooze(100);
+	}
+}
+
+int main()
+{
+	accelerant_base *acc = CreateAccelerantStub(3);
+	if (acc == NULL)
+		return 1;
+
+	amdgpu_device_handle dev;
+	uint32_t major, minor;
+	int ret = amdgpu_device_initialize_haiku(acc, &major, &minor, &dev);
+	acc->vt->ReleaseReference(acc);
+	CheckRet(ret);
+
+	amdgpu_context_handle low, high;
+	uint32_t lowId, highId;
+	CheckRet(CreateContext(dev, AMDGPU_CTX_PRIORITY_LOW, &low, &lowId));
+	CheckRet(CreateContext(dev, AMDGPU_CTX_PRIORITY_HIGH, &high, &highId));
+
+	// setting the coalescing flushes the queue, which lets its next batch
+	// pass without holding back
+	struct amdgpu_cs_fence lowFence, highFence;
+	CheckRet(Submit(low, &lowFence));
+	CheckRet(WaitIdle(&lowFence));
+
+	drmStubResetStats();
+	drmStubSetBlockedContext(highId);
+
+	for (int i = 0; i < HIGH_COUNT; i++)
+		CheckRet(Submit(high, &highFence));
+	bigtime_t start = system_time();
+	for (int i = 0; i < LOW_COUNT; i++)
+		CheckRet(Submit(low, &lowFence));
+
+	// the low priority worker isn't starved
+	DrmStubStats stats;
+	for (;;) {
+		drmStubGetStats(stats);
+		if (stats.submissionCount >= LOW_HELD_BACK)
+			break;
+		if (system_time() - start > WAIT_LIMIT) {
+			fprintf(stderr, "%u low priority submissions, expected %u\n",
+				stats.submissionCount, LOW_HELD_BACK);
+			return 1;
+		}
+		snooze(1000);
+	}
+
+	drmStubSetBlockedContext(0);
+
+	uint32_t expired;
+	CheckRet(amdgpu_cs_query_fence_status(&highFence, AMDGPU_TIMEOUT_INFINITE, 0, &expired));
+	CheckRet(amdgpu_cs_query_fence_status(&lowFence, AMDGPU_TIMEOUT_INFINITE, 0, &expired));
+
+	drmStubGetStats(stats);
+	if (stats.submissionCount != LOW_COUNT + HIGH_COUNT) {
+		fprintf(stderr, "%u submissions, expected %u\n", stats.submissionCount, LOW_COUNT + HIGH_COUNT);
+		return 1;
+	}
+
+	// every low priority submission before the first high priority one
+	// waited the whole hold-back after the previous one
+	bigtime_t previous = start;
+	for (uint32_t i = 0; i < stats.submissionCount && stats.submissionCtx[i] == lowId; i++) {
+		if (stats.submissionTime[i] - previous < HOLD_BACK) {
+			fprintf(stderr, "low priority submission %u held back for %" B_PRId64 " us\n",
+				i, stats.submissionTime[i] - previous);
+			for (uint32_t j = 0; j < stats.submissionCount; j++)
+				fprintf(stderr, "%c", stats.submissionCtx[j] == highId ? 'H' : 'L');
+			fprintf(stderr, "\n");
+			return 1;
+		}
+		previous = stats.submissionTime[i];
+	}
+
+	CheckRet(amdgpu_cs_ctx_free(high));
+	CheckRet(amdgpu_cs_ctx_free(low));
+	CheckRet(amdgpu_device_deinitialize(dev));
+	return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * Checks that reserving a VMID passes through the accelerant and saves
+ * the VM flushes of a VM competing with others for the VMIDs.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+extern "C" {
+#include <libdrm/amdgpu_drm.h>
+#include "amdgpu.h"
+}
+
+#include "accelerantStub.h"
+#include "libdrmStub.h"
+
+#define CheckRet(expr) {int _err = (expr); if (_err != 0) {fprintf(stderr, "%s failed: %d\n", #expr, _err); return 1;}}
+
+// more VMs than the stub has VMIDs
+#define VM_COUNT	3
+#define ROUNDS		16
+
+
+static int Submit(amdgpu_context_handle ctx)
+{
+	struct amdgpu_cs_ib_info ib;
+	memset(&ib, 0, sizeof(ib));
+	ib.ib_mc_address = 0x100000;
+	ib.size = 16;
+
+	struct amdgpu_cs_request request;
+	memset(&request, 0, sizeof(request));
+	request.ip_type = AMDGPU_HW_IP_GFX;
+	request.number_of_ibs = 1;
+	request.ibs = &ib;
+
+	return amdgpu_cs_submit(ctx, 0, &request, 1);
+}
+
+// Submit from the VMs in turn
+static int RunRounds(amdgpu_context_handle *ctxs, DrmStubStats &stats)
+{
+	drmStubResetStats();
+	for (int round = 0; round < ROUNDS; round++) {
+		for (int i = 0; i < VM_COUNT; i++)
+			CheckRet(Submit(ctxs[i]));
+	}
+	drmStubGetStats(stats);
+	return 0;
+}
+
+int main()
+{
+	amdgpu_device_handle devs[VM_COUNT];
+	amdgpu_context_handle ctxs[VM_COUNT];
+	for (int i = 0; i < VM_COUNT; i++) {
+		// a DRM file per device, so each has its own VM
+		accelerant_base *acc = CreateAccelerantStub(3 + i);
+		if (acc == NULL)
+			return 1;
+
+		uint32_t major, minor;
+		int ret = amdgpu_device_initialize_haiku(acc, &major, &minor, &devs[i]);
+		acc->vt->ReleaseReference(acc);
+		CheckRet(ret);
+		CheckRet(amdgpu_cs_ctx_create(devs[i], &ctxs[i]));
+	}
+
+	DrmStubStats shared, reserved;
+	CheckRet(RunRounds(ctxs, shared));
+
+	// only the first reservation reaches the accelerant
+	CheckRet(amdgpu_vm_reserve_vmid(devs[0], 0));
+	CheckRet(amdgpu_vm_reserve_vmid(devs[0], 0));
+	CheckRet(RunRounds(ctxs, reserved));
+	CheckRet(amdgpu_vm_unreserve_vmid(devs[0], 0));
+	CheckRet(amdgpu_vm_unreserve_vmid(devs[0], 0));
+	if (amdgpu_vm_unreserve_vmid(devs[0], 0) != EINVAL) {
+		fprintf(stderr, "unbalanced amdgpu_vm_unreserve_vmid() succeeded\n");
+		return 1;
+	}
+
+	printf("without reservation: %u VMID switches, %u flushes\n", shared.vmidSwitches, shared.vmidFlushes);
+	printf("with reservation:    %u VMID switches, %u flushes\n", reserved.vmidSwitches, reserved.vmidFlushes);
+
+	if (shared.vmidFlushes == 0) {
+		fprintf(stderr, "the VMs didn't compete for VMIDs\n");
+		return 1;
+	}
+	// the VM with the reservation stops taking VMIDs over from the others
+	if (reserved.vmidFlushes >= shared.vmidFlushes) {
+		fprintf(stderr, "the reservation saved no flushes\n");
+		return 1;
+	}
+
+	for (int i = 0; i < VM_COUNT; i++) {
+		CheckRet(amdgpu_cs_ctx_free(ctxs[i]));
+		CheckRet(amdgpu_device_deinitialize(devs[i]));
+	}
+	return 0;
+}